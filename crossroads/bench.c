@@ -0,0 +1,97 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "projects/crossroads/bench.h"
+#include "projects/crossroads/crossroads.h"
+#include "projects/crossroads/stats.h"
+#include "projects/crossroads/trace.h"
+
+/* Baselines leave some room over the worst of repeated runs with
+   vehicle threads, the planner and a worker pool, since the thread
+   schedule changes the outcome a little from run to run */
+static const struct bench_scenario bench_scenarios[] = {
+    /* Light load, every route */
+    { "light", NULL, 400, 1, { 5, 5, 5, 5 }, { 3, 4, 2, 1 }, 0,
+      420, 60, 8, 100 },
+    /* Every approach near what the center can take */
+    { "saturated", NULL, 400, 2, { 16, 16, 16, 16 }, { 3, 4, 2, 1 }, 0,
+      480, 2900, 170, 100 },
+    /* Only U-turns, A to A and so on: the longest routes */
+    { "uturn", NULL, 400, 3, { 6, 6, 6, 6 }, { 0, 0, 0, 1 }, 0,
+      440, 600, 55, 100 },
+    /* Four ambulances at once, three times, over steady traffic */
+    { "ambulance",
+      "E1AC50.70:E2BD50.70:E3CA50.70:E4DB50.70:"
+      "E5AB150.170:E6BC150.170:E7CD150.170:E8DA150.170:"
+      "E9AD250.270:E10BA250.270:E11CB250.270:E12DC250.270",
+      300, 4, { 12, 12, 12, 12 }, { 3, 4, 2, 1 }, 0,
+      350, 2000, 150, 60 },
+    /* Heavy east-west flow against a light north-south one */
+    { "asymmetric", NULL, 400, 5, { 25, 4, 25, 4 }, { 2, 6, 1, 1 }, 0,
+      440, 1100, 75, 100 },
+};
+
+#define BENCH_CNT ((int) (sizeof bench_scenarios / sizeof bench_scenarios[0]))
+
+/* Returns the scenario called NAME, or NULL */
+const struct bench_scenario* find_bench(const char* name)
+{
+    for (int i = 0; i < BENCH_CNT; i++) {
+        if (!strcmp(name, bench_scenarios[i].name)) {
+            return &bench_scenarios[i];
+        }
+    }
+    return NULL;
+}
+
+/* Sets the options BENCH runs with: headless, quiet, and its traffic */
+void apply_bench(const struct bench_scenario* bench)
+{
+    crossroads_options.fast = true;
+    crossroads_options.render_every = 0;
+    crossroads_options.trace_level = TRACE_OFF;
+    crossroads_options.generate = bench->generate;
+    crossroads_options.seed = bench->seed;
+    for (int i = 0; i < 4; i++) {
+        crossroads_options.rates[i] = bench->rates[i];
+        crossroads_options.mix[i] = bench->mix[i];
+    }
+    crossroads_options.ambulances = bench->ambulances;
+}
+
+/* Checks one number against its baseline */
+static bool within(const char* what, int value, int limit, bool is_max)
+{
+    if (is_max ? value <= limit : value >= limit) {
+        return true;
+    }
+    printf("bench: %s %d, baseline %s %d\n", what, value,
+        is_max ? "at most" : "at least", limit);
+    return false;
+}
+
+/* Prints the BENCH line for the run that just ended, TICKS long, and
+   returns true if it met the baseline. TICKS is only printed, see
+   bench.h. */
+bool bench_report(const struct bench_scenario* bench, int64_t ticks)
+{
+    struct run_summary summary;
+    int mean_delay, amb_hit;
+    bool pass;
+
+    get_run_summary(&summary);
+    mean_delay = summary.arrived > 0 ? summary.delay_total * 100 / summary.arrived : 0;
+    amb_hit = summary.ambulances > 0 ? summary.amb_on_time * 100 / summary.ambulances : 100;
+
+    pass = within("steps", summary.steps, bench->max_steps, true);
+    pass &= within("mean delay x100", mean_delay, bench->max_mean_delay, true);
+    pass &= within("p99 delay", summary.delay_p99, bench->max_p99_delay, true);
+    pass &= within("ambulance hit rate", amb_hit, bench->min_amb_hit, false);
+
+    printf("BENCH name=%s steps=%d ticks=%lld vehicles=%d mean_delay=%d.%02d "
+        "p99_delay=%d amb_hit=%d result=%s\n",
+        bench->name, summary.steps, (long long) ticks, summary.arrived,
+        mean_delay / 100, mean_delay % 100, summary.delay_p99, amb_hit,
+        pass ? "PASS" : "FAIL");
+    return pass;
+}
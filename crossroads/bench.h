@@ -0,0 +1,42 @@
+#ifndef __PROJECTS_CROSSROADS_BENCH_H__
+#define __PROJECTS_CROSSROADS_BENCH_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Built-in benchmark scenarios.
+
+   "-bench=NAME" runs a named scenario headless and prints one line
+   that scripts can pick up:
+
+     BENCH name=light steps=.. ticks=.. vehicles=.. mean_delay=..
+       p99_delay=.. amb_hit=.. result=PASS
+
+   Delay is the steps a vehicle took over its route length, counted
+   from its arrival. The run passes if it does no worse than the
+   baseline stored with the scenario. Ticks are printed but have no
+   baseline: they are wall-clock time, which depends on the machine
+   and on how the threads happen to be scheduled, so they vary from
+   run to run while the step counts do not. Options given after
+   -bench override the scenario's, e.g. "-bench=light:-planner". */
+struct bench_scenario {
+    const char *name;
+    const char *vehicles;           /* Fixed vehicle list, or NULL */
+    int generate;                   /* Generator settings, see scenario.h */
+    int seed;
+    int rates[4];
+    int mix[4];
+    int ambulances;
+
+    /* Baseline */
+    int max_steps;                  /* Steps to drain */
+    int max_mean_delay;             /* In hundredths of a step */
+    int max_p99_delay;
+    int min_amb_hit;                /* Percent of ambulances on time */
+};
+
+const struct bench_scenario *find_bench(const char *name);
+void apply_bench(const struct bench_scenario *bench);
+bool bench_report(const struct bench_scenario *bench, int64_t ticks);
+
+#endif /* __PROJECTS_CROSSROADS_BENCH_H__ */
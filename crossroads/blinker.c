@@ -3,6 +3,10 @@
 #include "projects/crossroads/blinker.h"
 #include "projects/crossroads/vehicle.h"
 #include "projects/crossroads/crossroads.h"
+#include "projects/crossroads/deadlock_prevention.h"
+#include "projects/crossroads/lock_stats.h"
+#include "projects/crossroads/trace.h"
+#include "projects/crossroads/step_timing.h"
 #include "threads/interrupt.h"
 #include <stdio.h>
 
@@ -13,17 +17,24 @@
 /* Global blinker variables */
 static struct blinker_info* global_blinkers;
 static struct lock blinker_control_lock;
+static struct lock_stats blinker_control_stats;
 static int current_blinker_state = BLINKER_NS_GREEN;
 static int step_counter = 0;
+static int green_elapsed = 0;   /* Steps since the last switch */
 static bool blinker_running = false;
 
+/* Step handshake with the step barrier */
+static struct semaphore step_advanced;    /* Upped once per unit step */
+static struct semaphore step_applied;     /* Upped when the plan is applied */
+static struct semaphore blinker_stopped;  /* Upped when the thread exits */
+
 /* Thread IDs for blinkers */
 static tid_t blinker_threads[NUM_BLINKER];
 
 /* Function prototypes */
 static void blinker_thread_func(void* aux);
 
-void init_blinker(struct blinker_info* blinkers, struct lock** map_locks, struct vehicle_info* vehicle_info) {
+void init_blinker(struct blinker_info* blinkers, struct list* vehicles) {
     printf("Initializing simplified traffic light system...\n");
 
     /* Store global references */
@@ -31,16 +42,20 @@ void init_blinker(struct blinker_info* blinkers, struct lock** map_locks, struct
 
     /* Initialize synchronization primitives */
     lock_init(&blinker_control_lock);
+    lock_stats_register(&blinker_control_stats, "blinker control");
+    sema_init(&step_advanced, 0);
+    sema_init(&step_applied, 0);
+    sema_init(&blinker_stopped, 0);
 
     /* Initialize blinker info for each blinker */
     for (int i = 0; i < NUM_BLINKER; i++) {
-        blinkers[i].map_locks = map_locks;
-        blinkers[i].vehicles = vehicle_info;
+        blinkers[i].vehicles = vehicles;
     }
 
     /* Initial state: North-South green */
     current_blinker_state = BLINKER_NS_GREEN;
     step_counter = 0;
+    green_elapsed = 0;
     blinker_running = true;
 
     printf("Traffic light system initialized with NS green\n");
@@ -56,37 +71,197 @@ void start_blinker() {
     printf("Traffic light system started\n");
 }
 
-static void blinker_thread_func(void* aux) {
+/* Stops the controller thread and waits for it to exit. Called once
+   the last vehicle has left, so no step can advance any more. */
+void stop_blinker(void) {
+    blinker_running = false;
+    sema_up(&step_advanced);
+    sema_down(&blinker_stopped);
+
+    printf("Traffic light system stopped\n");
+}
+
+/* Phase a vehicle from START needs to enter the center */
+static int approach_phase(char start) {
+    return (start == 'A' || start == 'C') ? BLINKER_EW_GREEN : BLINKER_NS_GREEN;
+}
+
+static bool has_entered_center(struct vehicle_info* vi) {
+    return vi->path_step > route_info[vi->start - 'A'][vi->dest - 'A'].center_step;
+}
+
+/* Counts the vehicles still waiting to enter the center, per phase.
+   Runs while every vehicle is parked at the step barrier, so the
+   vehicle list does not change underneath. */
+static void count_queues(int queue[2]) {
     extern int crossroads_step;
+    struct list* vehicles = global_blinkers[0].vehicles;
+    struct list_elem* e;
 
-    while (blinker_running) {
-        lock_acquire(&blinker_control_lock);
-
-        /* Simple time-based switching every 3 steps */
-        if (crossroads_step > 0 && crossroads_step % 3 == 0 && step_counter != crossroads_step) {
-            if (current_blinker_state == BLINKER_NS_GREEN) {
-                current_blinker_state = BLINKER_EW_GREEN;
-                printf("Traffic light: East-West GREEN, North-South RED (step %d)\n", crossroads_step);
-            }
-            else {
-                current_blinker_state = BLINKER_NS_GREEN;
-                printf("Traffic light: North-South GREEN, East-West RED (step %d)\n", crossroads_step);
-            }
-            step_counter = crossroads_step;
+    queue[BLINKER_NS_GREEN] = queue[BLINKER_EW_GREEN] = 0;
+    for (e = list_begin(vehicles); e != list_end(vehicles); e = list_next(e)) {
+        struct vehicle_info* vi = list_entry(e, struct vehicle_info, elem);
+
+        if (vi->state == VEHICLE_STATUS_FINISHED || has_entered_center(vi)) {
+            continue;
+        }
+        if (vi->type == VEHICL_TYPE_AMBULANCE && crossroads_step < vi->arrival) {
+            continue;   /* Not dispatched yet */
         }
+        queue[approach_phase(vi->start)]++;
+    }
+}
+
+static void switch_phase(void) {
+    if (current_blinker_state == BLINKER_NS_GREEN) {
+        current_blinker_state = BLINKER_EW_GREEN;
+        TRACE(TRACE_EVENTS, TRACE_LIGHT, NULL, BLINKER_EW_GREEN, 0);
+    }
+    else {
+        current_blinker_state = BLINKER_NS_GREEN;
+        TRACE(TRACE_EVENTS, TRACE_LIGHT, NULL, BLINKER_NS_GREEN, 0);
+    }
+    green_elapsed = 0;
+}
+
+/* Fixed plan: switch every 3 steps whatever the demand */
+static void apply_fixed_plan(void) {
+    extern int crossroads_step;
+
+    if (crossroads_step > 0 && crossroads_step % 3 == 0 && step_counter != crossroads_step) {
+        switch_phase();
+        step_counter = crossroads_step;
+    }
+}
 
-        lock_release(&blinker_control_lock);
+/* Actuated plan: hold green for at least green_min steps, keep it
+   while its queue is not empty up to green_max, and never hand the
+   green to a side nobody is waiting on. */
+static void apply_actuated_plan(void) {
+    int queue[2];
+    int green = current_blinker_state;
+    int red = (green == BLINKER_NS_GREEN) ? BLINKER_EW_GREEN : BLINKER_NS_GREEN;
 
-        /* Yield to other threads */
-        thread_yield();
+    green_elapsed++;
+    count_queues(queue);
+
+    if (queue[red] == 0) {
+        return;     /* Skip the red phase, it has no demand */
+    }
+    if (green_elapsed < crossroads_options.green_min) {
+        return;
     }
+    if (queue[green] > 0 && green_elapsed < crossroads_options.green_max) {
+        return;     /* Extend the green */
+    }
+    switch_phase();
+}
+
+/* The dispatched ambulance still short of the center that most
+   needs a green: one that can make its golden time before one that
+   cannot, then least slack. NULL if there is none. */
+static struct vehicle_info* most_urgent_ambulance(void) {
+    extern int crossroads_step;
+    struct list* vehicles = global_blinkers[0].vehicles;
+    struct list_elem* e;
+    struct vehicle_info* best = NULL;
+    int best_slack = 0;
+
+    for (e = list_begin(vehicles); e != list_end(vehicles); e = list_next(e)) {
+        struct vehicle_info* vi = list_entry(e, struct vehicle_info, elem);
+        int slack;
+
+        if (vi->type != VEHICL_TYPE_AMBULANCE || vi->state == VEHICLE_STATUS_FINISHED ||
+            crossroads_step < vi->arrival || has_entered_center(vi)) {
+            continue;
+        }
+        slack = vehicle_slack(vi);
+        if (best == NULL || ((slack >= 0) != (best_slack >= 0) ? slack >= 0 : slack < best_slack)) {
+            best = vi;
+            best_slack = slack;
+        }
+    }
+    return best;
+}
+
+/* Ambulance preemption: while an ambulance is on its way to the
+   center, its approach gets the green whatever the plan says.
+   Returns true if it set the phase for this step. */
+static bool preempt_for_ambulance(void) {
+    struct vehicle_info* vi;
+
+    if (crossroads_options.wave_length == 0) {
+        return false;
+    }
+    vi = most_urgent_ambulance();
+    if (vi == NULL) {
+        return false;
+    }
+
+    if (current_blinker_state != approach_phase(vi->start)) {
+        switch_phase();
+        TRACE(TRACE_EVENTS, TRACE_AMB_PREEMPT, vi, current_blinker_state, 0);
+    }
+    else {
+        green_elapsed++;
+    }
+    return true;
+}
+
+/* Applies the signal plan for the current unit step */
+static void apply_signal_plan(void) {
+    counted_lock_acquire(&blinker_control_lock, &blinker_control_stats);
+
+    if (preempt_for_ambulance()) {
+        /* The ambulance decides this step */
+    }
+    else if (crossroads_options.fixed_signal) {
+        apply_fixed_plan();
+    }
+    else {
+        apply_actuated_plan();
+    }
+
+    lock_release(&blinker_control_lock);
+}
+
+/* The controller sleeps until the step barrier reports a new unit
+   step, so it costs nothing between steps */
+static void blinker_thread_func(void* aux UNUSED) {
+    int64_t timing_start;
+
+    while (true) {
+        sema_down(&step_advanced);
+        if (!blinker_running) {
+            break;
+        }
+
+        timing_start = TIMING_NOW();
+        apply_signal_plan();
+        TIMING_RECORD(TIMING_SIGNAL_PLAN, timing_start);
+        sema_up(&step_applied);
+    }
+
+    sema_up(&blinker_stopped);
+}
+
+/* Called by the step barrier after crossroads_step advances. Wakes
+   the controller and waits until it has applied the new step, so
+   every vehicle sees the same light for the whole step. */
+void blinker_step_changed(void) {
+    if (!blinker_running) {
+        return;
+    }
+
+    sema_up(&step_advanced);
+    sema_down(&step_applied);
 }
 
 /* Public function to check if vehicle can proceed based on traffic light */
 bool can_vehicle_proceed(struct position current, struct position next) {
     bool can_proceed = true;
 
-    lock_acquire(&blinker_control_lock);
+    counted_lock_acquire(&blinker_control_lock, &blinker_control_stats);
 
     /* Determine movement direction */
     int row_diff = next.row - current.row;
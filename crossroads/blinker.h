@@ -8,12 +8,13 @@
 #define NUM_BLINKER 4
 
 struct blinker_info {
-    struct lock **map_locks;
-    struct vehicle_info *vehicles;
+    struct list *vehicles;          /* Vehicles on the road, see vehicle.h */
 };
 
-void init_blinker(struct blinker_info* blinkers, struct lock **map_locks, struct vehicle_info * vehicle_info);
+void init_blinker(struct blinker_info* blinkers, struct list *vehicles);
 void start_blinker(void);
+void stop_blinker(void);
+void blinker_step_changed(void);
 
 /* Additional functions for traffic light control */
 bool can_vehicle_proceed(struct position current, struct position next);
@@ -1,7 +1,9 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "threads/init.h"
+#include "threads/interrupt.h"
 #include "threads/malloc.h"
 #include "threads/synch.h"
 #include "threads/thread.h"
@@ -9,115 +11,323 @@
 #include "devices/timer.h"
 
 #include "projects/crossroads/crossroads.h"
+#include "projects/crossroads/bench.h"
 #include "projects/crossroads/blinker.h"
+#include "projects/crossroads/layout.h"
+#include "projects/crossroads/lock_stats.h"
 #include "projects/crossroads/vehicle.h"
 #include "projects/crossroads/map.h"
+#include "projects/crossroads/scenario.h"
+#include "projects/crossroads/stats.h"
+#include "projects/crossroads/step_timing.h"
+#include "projects/crossroads/trace.h"
+#include "projects/crossroads/watchdog.h"
 
 #include "projects/crossroads/ats.h"
 
 int crossroads_step;
+struct crossroads_options crossroads_options;
 
-static void init_map_locks(struct lock ***map_locks) 
+static void set_default_options(void)
 {
-	int i, j;
-	struct lock **__map_locks;
-
-	__map_locks = *map_locks = malloc(sizeof (struct lock *) * 7);
-	for (i=0; i<7; i++) {
-		__map_locks[i] = malloc(sizeof (struct lock) * 7);
-		for (j=0; j<7; j++) {
-			lock_init(&__map_locks[i][j]);
+	crossroads_options.fast = false;
+	crossroads_options.fixed_signal = false;
+	crossroads_options.green_min = 2;
+	crossroads_options.green_max = 8;
+	crossroads_options.trace_level = TRACE_EVENTS;
+	crossroads_options.render_every = 1;
+	crossroads_options.aging_steps = 4;
+	crossroads_options.max_wait = 32;
+	crossroads_options.wave_length = 6;
+	crossroads_options.watchdog = 100;
+	crossroads_options.watchdog_policy = WATCHDOG_RELEASE;
+	crossroads_options.workers = 0;
+	crossroads_options.slots = 0;
+	crossroads_options.planner = false;
+	crossroads_options.lock_stats = false;
+	crossroads_options.map = find_map_layout("default");
+	crossroads_options.generate = 0;
+	crossroads_options.seed = 1;
+	for (int i = 0; i < 4; i++) {
+		crossroads_options.rates[i] = 10;
+	}
+	crossroads_options.mix[0] = 3;
+	crossroads_options.mix[1] = 4;
+	crossroads_options.mix[2] = 2;
+	crossroads_options.mix[3] = 1;
+	crossroads_options.ambulances = 0;
+	crossroads_options.bench = NULL;
+}
+
+/* Reads the comma-separated VALUE into the 4 entries of OUT. A single
+   number stands for all four. */
+static void parse_four(const char *opt, char *value, int out[4])
+{
+	char *token, *saveptr;
+	int n = 0;
+
+	for (token = strtok_r(value, ",", &saveptr); token != NULL;
+			token = strtok_r(NULL, ",", &saveptr)) {
+		if (n == 4) {
+			PANIC("too many values for %s", opt);
 		}
+		out[n++] = atoi(token);
+	}
+	if (n == 1) {
+		out[1] = out[2] = out[3] = out[0];
+	} else if (n != 4) {
+		PANIC("%s takes 1 or 4 values", opt);
 	}
 }
 
-static void release_map_locks(struct lock **map_locks)
+static void apply_option(char *opt)
 {
-	int i;
-	for (i=0; i<7; i++) {
-		free(map_locks[i]);
+	char *value = strchr(opt, '=');
+
+	if (value != NULL) {
+		*value++ = '\0';
+	}
+
+	if (!strcmp(opt, "-fast")) {
+		crossroads_options.fast = true;
+	} else if (!strcmp(opt, "-fixed-signal")) {
+		crossroads_options.fixed_signal = true;
+	} else if (!strcmp(opt, "-green-min") && value != NULL) {
+		crossroads_options.green_min = atoi(value);
+	} else if (!strcmp(opt, "-green-max") && value != NULL) {
+		crossroads_options.green_max = atoi(value);
+	} else if (!strcmp(opt, "-trace") && value != NULL) {
+		crossroads_options.trace_level = atoi(value);
+	} else if (!strcmp(opt, "-render") && value != NULL) {
+		crossroads_options.render_every = atoi(value);
+	} else if (!strcmp(opt, "-aging") && value != NULL) {
+		crossroads_options.aging_steps = atoi(value);
+	} else if (!strcmp(opt, "-max-wait") && value != NULL) {
+		crossroads_options.max_wait = atoi(value);
+	} else if (!strcmp(opt, "-wave") && value != NULL) {
+		crossroads_options.wave_length = atoi(value);
+	} else if (!strcmp(opt, "-workers") && value != NULL) {
+		crossroads_options.workers = atoi(value);
+	} else if (!strcmp(opt, "-slots") && value != NULL) {
+		crossroads_options.slots = atoi(value);
+	} else if (!strcmp(opt, "-map") && value != NULL) {
+		crossroads_options.map = find_map_layout(value);
+		if (crossroads_options.map == NULL) {
+			PANIC("unknown map `%s'", value);
+		}
+	} else if (!strcmp(opt, "-generate") && value != NULL) {
+		crossroads_options.generate = atoi(value);
+	} else if (!strcmp(opt, "-seed") && value != NULL) {
+		crossroads_options.seed = atoi(value);
+	} else if (!strcmp(opt, "-rates") && value != NULL) {
+		parse_four(opt, value, crossroads_options.rates);
+	} else if (!strcmp(opt, "-mix") && value != NULL) {
+		parse_four(opt, value, crossroads_options.mix);
+	} else if (!strcmp(opt, "-ambulances") && value != NULL) {
+		crossroads_options.ambulances = atoi(value);
+	} else if (!strcmp(opt, "-bench") && value != NULL) {
+		crossroads_options.bench = find_bench(value);
+		if (crossroads_options.bench == NULL) {
+			PANIC("unknown benchmark `%s'", value);
+		}
+		apply_bench(crossroads_options.bench);
+	} else if (!strcmp(opt, "-planner")) {
+		crossroads_options.planner = true;
+	} else if (!strcmp(opt, "-lockstats")) {
+		crossroads_options.lock_stats = true;
+	} else if (!strcmp(opt, "-watchdog") && value != NULL) {
+		crossroads_options.watchdog = atoi(value);
+	} else if (!strcmp(opt, "-watchdog-policy") && value != NULL) {
+		if (!strcmp(value, "release")) {
+			crossroads_options.watchdog_policy = WATCHDOG_RELEASE;
+		} else if (!strcmp(value, "fail")) {
+			crossroads_options.watchdog_policy = WATCHDOG_FAIL;
+		} else {
+			PANIC("unknown watchdog policy `%s'", value);
+		}
+	} else {
+		PANIC("unknown crossroads option `%s'", opt);
 	}
-	free(map_locks);
 }
 
-static int is_finished(struct vehicle_info *vehicle_info, int thread_cnt)
+/* Applies the '-name[=value]' tokens of INPUT and returns a
+   malloc'd copy of the remaining ':'-separated vehicle list. */
+static char *parse_options(const char *input)
 {
-	int i, res;
+	char *input_copy, *vehicles, *token, *saveptr;
+	size_t len = strlen(input) + 1;
+
+	input_copy = malloc(len);
+	vehicles = malloc(len);
+	strlcpy(input_copy, input, len);
+	vehicles[0] = '\0';
 
-	res = thread_cnt;
-	for (i=0; i<thread_cnt; i++) {
-		if (vehicle_info[i].state == VEHICLE_STATUS_FINISHED) {
-			res--;
+	for (token = strtok_r(input_copy, ":", &saveptr); token != NULL;
+			token = strtok_r(NULL, ":", &saveptr)) {
+		if (token[0] == '-') {
+			apply_option(token);
+			continue;
+		}
+		if (vehicles[0] != '\0') {
+			strlcat(vehicles, ":", len);
 		}
+		strlcat(vehicles, token, len);
+	}
+
+	free(input_copy);
+
+	/* a benchmark brings its own vehicles unless some are given */
+	if (crossroads_options.bench != NULL && crossroads_options.bench->vehicles != NULL &&
+			vehicles[0] == '\0') {
+		free(vehicles);
+		len = strlen(crossroads_options.bench->vehicles) + 1;
+		vehicles = malloc(len);
+		strlcpy(vehicles, crossroads_options.bench->vehicles, len);
 	}
 
-	/* return 0 when terminated */
-	return res;
+	if (crossroads_options.green_min < 1 ||
+			crossroads_options.green_max < crossroads_options.green_min) {
+		PANIC("bad green bounds %d..%d", crossroads_options.green_min,
+				crossroads_options.green_max);
+	}
+	if (crossroads_options.render_every < 0) {
+		PANIC("bad render interval %d", crossroads_options.render_every);
+	}
+	if (crossroads_options.workers < 0) {
+		PANIC("bad worker count %d", crossroads_options.workers);
+	}
+	if (crossroads_options.slots < 0) {
+		PANIC("bad slot limit %d", crossroads_options.slots);
+	}
+	if (crossroads_options.watchdog < 0) {
+		PANIC("bad watchdog period %d", crossroads_options.watchdog);
+	}
+	if (crossroads_options.wave_length < 0) {
+		PANIC("bad wave length %d", crossroads_options.wave_length);
+	}
+	if (crossroads_options.aging_steps < 0 || crossroads_options.max_wait < 0) {
+		PANIC("bad aging %d or max wait %d", crossroads_options.aging_steps,
+				crossroads_options.max_wait);
+	}
+	if (crossroads_options.generate < 0) {
+		PANIC("bad generation period %d", crossroads_options.generate);
+	}
+	for (int i = 0; i < 4; i++) {
+		if (crossroads_options.rates[i] < 0 || crossroads_options.rates[i] > 100) {
+			PANIC("bad arrival rate %d for %c", crossroads_options.rates[i], 'A' + i);
+		}
+		if (crossroads_options.mix[i] < 0) {
+			PANIC("bad turn weight %d", crossroads_options.mix[i]);
+		}
+	}
+	if (crossroads_options.mix[0] + crossroads_options.mix[1] +
+			crossroads_options.mix[2] + crossroads_options.mix[3] == 0) {
+		PANIC("turn mix is all zero");
+	}
+	if (crossroads_options.ambulances < 0 || crossroads_options.ambulances > 100) {
+		PANIC("bad ambulance share %d", crossroads_options.ambulances);
+	}
+	return vehicles;
 }
 
 void run_crossroads(char **argv)
 {
-	int i, thread_cnt;
-	struct lock **map_locks;
-	struct vehicle_info *vehicle_info;
+	int drawn_step = -1;
+	int64_t start_ticks, run_ticks, timing_start;
+	char *vehicles;
 	struct blinker_info* blinkers;
+	struct list_elem *e;
+	enum intr_level old_level;
 
 	/* initialize unit step */
 	crossroads_step = 0;
 
-	/* prepare crossroads map */
-	init_map_locks(&map_locks);
+	/* pick up run-time options */
+	set_default_options();
+	vehicles = parse_options(argv[1]);
 
-	/* prepare vehicle data */
-	thread_cnt = 1;
-	for (i=0; (size_t) i<strlen(argv[1]); i++) {
-		if (argv[1][i] == ':') {
-			thread_cnt++;
-		}
+	if (vehicles[0] == '\0' && crossroads_options.generate == 0) {
+		printf("no vehicles given.\n");
+		free(vehicles);
+		return;
 	}
-	printf("initializing %d vehicles...\n", thread_cnt);
-	vehicle_info = malloc(sizeof(struct vehicle_info) * thread_cnt);
-	parse_vehicles(vehicle_info, argv[1]);
 
-	for (i=0; i<thread_cnt; i++) {
-		/* put map locks */
-		vehicle_info[i].map_locks = map_locks;
-	}
+	/* prepare crossroads map */
+	init_map_layout(crossroads_options.map);
 
-	init_on_mainthread(thread_cnt);
+	/* vehicles are read and let in as they arrive */
+	init_scenario(vehicles);
+	init_lock_stats();
+	init_on_mainthread();
+	init_run_stats();
+	init_step_timing();
+	trace_init();
+	init_watchdog(&active_vehicles);
 
 	blinkers = malloc(sizeof(struct blinker_info) * NUM_BLINKER);
-	init_blinker(blinkers, map_locks, vehicle_info);
-
-	/* prepare threads for each vehicle */ 
-	printf("initializing vehicle threads...\n");
-	for (i=0; i<thread_cnt; i++) {
-		char name[16];
-		snprintf(name, sizeof name, "thread %c", vehicle_info[i].id);
-		thread_create(name, PRI_DEFAULT, vehicle_loop, &vehicle_info[i]);
-	}
+	init_blinker(blinkers, &active_vehicles);
 	start_blinker();
 
+	printf("initializing vehicles...\n");
+	start_ticks = timer_ticks();
+	start_vehicles();
+
 	printf("running project2 crossroads ...\n");
 
 #if 1
-	/* main loop */
-	do {
-		map_draw();
-		for (i=0; i<thread_cnt; i++) {
-			map_draw_vehicle(vehicle_info[i].id, 
-							vehicle_info[i].position.row,
-							vehicle_info[i].position.col);
+	if (crossroads_options.fast) {
+		/* headless: steps advance as soon as the barrier completes */
+		wait_for_vehicles_finished();
+	} else {
+		/* main loop */
+		do {
+			if (crossroads_options.render_every > 0 && (drawn_step < 0 ||
+					crossroads_step - drawn_step >= crossroads_options.render_every)) {
+				drawn_step = crossroads_step;
+				timing_start = TIMING_NOW();
+				map_draw();
+				/* the list changes as vehicles come and go */
+				old_level = intr_disable();
+				for (e = list_begin(&active_vehicles); e != list_end(&active_vehicles);
+						e = list_next(e)) {
+					struct vehicle_info *vi = list_entry(e, struct vehicle_info, elem);
+
+					/* only vehicles on the map have a cell to draw */
+					if (vi->state != VEHICLE_STATUS_RUNNING) {
+						continue;
+					}
+					map_draw_vehicle(vi->name, vi->position.row, vi->position.col);
+				}
+				intr_set_level(old_level);
+				map_draw_flush();
+				TIMING_RECORD(TIMING_DRAW, timing_start);
+			}
+			/* sleep */
+			timer_msleep(1000);
+		} while (!vehicles_finished());
+		if (drawn_step >= 0) {
+			map_draw_reset();
 		}
-		/* sleep */
-		timer_msleep(1000);
-	} while (is_finished(vehicle_info, thread_cnt));
+	}
+
+	run_ticks = timer_elapsed(start_ticks);
+	printf("finished at unit step %d\n", crossroads_step);
+	if (watchdog_aborted()) {
+		printf("run aborted by the watchdog\n");
+	}
+	stop_blinker();
+	release_vehicles();
+	trace_dump();
+	print_run_report();
+	print_step_timing();
+	print_lock_stats();
+	if (crossroads_options.bench != NULL) {
+		bench_report(crossroads_options.bench, run_ticks);
+	}
 
 	/* dealloc */
-	map_draw_reset();
 	printf("finished. releasing resources ...\n");
-	release_map_locks(map_locks);
-	free(vehicle_info);
+	free(vehicles);
 	free(blinkers);
 	printf("good bye.\n");
 #endif
@@ -1,9 +1,39 @@
 #ifndef __PROJECTS_PROJECT2_CROASSROADS_H__
 #define __PROJECTS_PROJECT2_CROASSROADS_H__
 
+#include <stdbool.h>
+
 #define CROSSROADS_UNIT_TIME_MS 1000 
 
+/* Run-time options. Given as '-name[=value]' tokens mixed into
+   the vehicle list, e.g. "crossroads -fast:aAB:bBC". */
+struct crossroads_options {
+	bool fast;		/* headless, advance steps without sleeping */
+	bool fixed_signal;	/* fixed 3-step signal cycle instead of actuated */
+	int green_min;		/* actuated: shortest green, in steps */
+	int green_max;		/* actuated: longest green while the other side waits */
+	int trace_level;	/* events kept in the trace ring, see trace.h */
+	int render_every;	/* redraw the map every N steps, 0 for never */
+	int aging_steps;	/* waiters gain a priority level every N steps, 0 for never */
+	int max_wait;		/* waiters go first after N steps, 0 for no cap */
+	int wave_length;	/* cells kept clear ahead of an ambulance, 0 for none */
+	int watchdog;		/* steps without any move before recovery, 0 for never */
+	int watchdog_policy;	/* WATCHDOG_RELEASE or WATCHDOG_FAIL */
+	int workers;		/* worker threads driving the vehicles, 0 for one thread each */
+	int slots;		/* most vehicles let in at once, 0 for no limit */
+	bool planner;		/* move every vehicle from the step barrier, in a fixed order */
+	bool lock_stats;	/* count lock and cell contention, see lock_stats.h */
+	const struct map_layout *map;	/* geometry, see layout.h */
+	int generate;		/* steps of generated traffic, 0 for none, see scenario.h */
+	int seed;		/* generator seed */
+	int rates[4];		/* arrivals per 100 steps on approaches A..D */
+	int mix[4];		/* weights of right, straight, left and U-turn routes */
+	int ambulances;		/* percent of generated vehicles that are ambulances */
+	const struct bench_scenario *bench;	/* benchmark being run, see bench.h, or NULL */
+};
+
 extern int crossroads_step;
+extern struct crossroads_options crossroads_options;
 
 void run_crossroads(char **argv);
 
@@ -2,6 +2,8 @@
 #include "projects/crossroads/priority_sync.h"
 #include "projects/crossroads/vehicle.h"
 #include "projects/crossroads/crossroads.h"
+#include "projects/crossroads/trace.h"
+#include "projects/crossroads/stats.h"
 #include "threads/malloc.h"
 #include "threads/interrupt.h"
 #include <stdio.h>
@@ -22,16 +24,37 @@ void init_deadlock_prevention(void) {
 
     /* Initialize zone locks */
     for (int i = 0; i < NUM_ZONES; i++) {
-        priority_lock_init(&deadlock_system->zone_locks[i]);
+        char name[LOCK_NAME_LEN + 1];
+
+        snprintf(name, sizeof name, "zone %d", i);
+        priority_lock_init(&deadlock_system->zone_locks[i], name);
         deadlock_system->zones_occupied[i] = false;
         deadlock_system->zone_holders[i] = 0;
     }
 
-    /* Initialize intersection capacity semaphore with higher capacity */
-    priority_sema_init(&deadlock_system->intersection_capacity, 16);
+    /* Start with an empty reservation table */
+    for (int row = 0; row < MAP_MAX_SIZE; row++) {
+        for (int col = 0; col < MAP_MAX_SIZE; col++) {
+            for (int slot = 0; slot < RESERVATION_HORIZON; slot++) {
+                deadlock_system->reservations[row][col][slot].step = -1;
+                deadlock_system->reservations[row][col][slot].vehicle = -1;
+            }
+        }
+    }
+
+    for (int i = 0; i < 4; i++) {
+        deadlock_system->entry_waiters[i].vi = NULL;
+    }
+    for (int row = 0; row < MAP_MAX_SIZE; row++) {
+        for (int col = 0; col < MAP_MAX_SIZE; col++) {
+            deadlock_system->wave[row][col].vehicle = -1;
+            deadlock_system->wave[row][col].until = -1;
+        }
+    }
 
     /* Initialize resource ordering lock */
     lock_init(&deadlock_system->resource_order_lock);
+    lock_stats_register(&deadlock_system->resource_order_stats, "resource order");
 
     printf("Deadlock prevention system initialized\n");
 }
@@ -47,11 +70,10 @@ void init_intersection_safety(void) {
     /* Initialize safety check lock */
     lock_init(&safety_system->safety_check_lock);
 
-    /* Initialize conflict matrix - simplified for basic implementation */
-    for (int i = 0; i < 7; i++) {
-        for (int j = 0; j < 7; j++) {
-            safety_system->conflicting_moves[i][j] = false;
-        }
+    /* Build the route conflict matrix from vehicle_path */
+    update_conflict_matrix();
+    for (int i = 0; i < NUM_ROUTES; i++) {
+        safety_system->route_busy_until[i] = -1;
     }
 
     printf("Intersection safety system initialized\n");
@@ -69,11 +91,8 @@ void cleanup_deadlock_prevention(void) {
 }
 
 int get_zone_for_position(struct position pos) {
-    int row = pos.row;
-    int col = pos.col;
-
     /* Only core intersection positions need zone management */
-    if (row >= 2 && row <= 4 && col >= 2 && col <= 4) {
+    if (is_intersection_position(pos)) {
         return ZONE_CENTER;
     }
 
@@ -81,8 +100,12 @@ int get_zone_for_position(struct position pos) {
     return -1;
 }
 
+int get_vehicle_route(struct vehicle_info* vi) {
+    return (vi->start - 'A') * 4 + (vi->dest - 'A');
+}
+
 bool is_intersection_position(struct position pos) {
-    return (pos.row >= 2 && pos.row <= 4 && pos.col >= 2 && pos.col <= 4);
+    return pos.row >= 0 && pos.col >= 0 && (center_cells & CELL_BIT(pos)) != 0;
 }
 
 int get_movement_direction(struct position from, struct position to) {
@@ -97,7 +120,239 @@ int get_movement_direction(struct position from, struct position to) {
     return -1;
 }
 
+static struct cell_reservation* reservation_slot(struct position pos, int step) {
+    return &deadlock_system->reservations[pos.row][pos.col][step % RESERVATION_HORIZON];
+}
+
+static bool is_reserved_by_other(struct position pos, int step, int vehicle) {
+    struct cell_reservation* slot = reservation_slot(pos, step);
+    return slot->step == step && slot->vehicle != vehicle;
+}
+
+/* Collects the run of PATH through the center that starts at index
+   I, plus the exit cell behind it. Returns the number of cells
+   stored in CELLS. */
+static int path_center_run(const struct position* path, int i, struct position cells[]) {
+    int count = 0;
+
+    while (path[i].row != -1 && is_intersection_position(path[i])) {
+        cells[count++] = path[i++];
+    }
+    if (path[i].row != -1) {
+        cells[count++] = path[i];
+    }
+
+    ASSERT(count + 1 < RESERVATION_HORIZON);
+    return count;
+}
+
+/* The cells VI will occupy from its next move on */
+static int center_run(struct vehicle_info* vi, struct position cells[]) {
+    const struct position* path = vehicle_path[vi->start - 'A'][vi->dest - 'A'];
+    return path_center_run(path, vi->path_step, cells);
+}
+
+/* True if a vehicle whose route conflicts with ROUTE still holds
+   reservations at or after STEP */
+static bool has_active_conflict(int route, int step) {
+    for (int other = 0; other < NUM_ROUTES; other++) {
+        if (safety_system->conflicting_moves[route][other] &&
+            safety_system->route_busy_until[other] >= step) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Id of the ambulance whose green wave covers POS, or -1 */
+static int wave_owner(struct position pos) {
+    struct wave_claim* claim = &deadlock_system->wave[pos.row][pos.col];
+
+    return claim->until >= crossroads_step ? claim->vehicle : -1;
+}
+
+/* True if a normal vehicle at FROM must keep out of TO because TO is
+   on an ambulance's green wave. Vehicles already on a wave are ahead
+   of an ambulance and are let through, since moving on is how they
+   clear its way. */
+static bool wave_blocks(struct vehicle_info* vi, struct position from, struct position to) {
+    if (vi->type == VEHICL_TYPE_AMBULANCE || wave_owner(to) == -1) {
+        return false;
+    }
+    return from.row == -1 || wave_owner(from) == -1;
+}
+
+/* Reserves the center run of VI starting at the current step. Cell
+   k is held for steps now+k and now+k+1: the vehicle enters it in the
+   first and leaves it in the second, so whoever comes next never
+   depends on the order in which threads run within a step. */
+static bool reserve_center_run(struct vehicle_info* vi) {
+    struct position cells[RESERVATION_HORIZON];
+    int now = crossroads_step;
+    int count = center_run(vi, cells);
+    int route = get_vehicle_route(vi);
+    struct position from = vi->position;
+
+    /* Keep off the cells an ambulance is about to drive through */
+    for (int k = 0; k < count; k++) {
+        if (wave_blocks(vi, k == 0 ? from : cells[k - 1], cells[k])) {
+            return false;
+        }
+    }
+
+    /* Nothing on a conflicting route is in the center, so none of
+       our cells can be taken: skip the table lookups. A vehicle that
+       is late inside extends route_busy_until in hold_center_run(),
+       so it is never skipped. */
+    bool compatible = !has_active_conflict(route, now);
+
+    for (int k = 0; k < count && !compatible; k++) {
+        if (is_reserved_by_other(cells[k], now + k, vi->id) ||
+            is_reserved_by_other(cells[k], now + k + 1, vi->id)) {
+            return false;
+        }
+    }
+
+    for (int k = 0; k < count; k++) {
+        for (int step = now + k; step <= now + k + 1; step++) {
+            struct cell_reservation* slot = reservation_slot(cells[k], step);
+            slot->step = step;
+            slot->vehicle = vi->id;
+        }
+    }
+    if (safety_system->route_busy_until[route] < now + count) {
+        safety_system->route_busy_until[route] = now + count;
+    }
+    return true;
+}
+
+/* Holds POS at STEP for VEHICLE, unless somebody else already does */
+static void hold_slot(struct position pos, int step, int vehicle) {
+    struct cell_reservation* slot = reservation_slot(pos, step);
+
+    if (slot->step == step && slot->vehicle != vehicle) {
+        return;
+    }
+    slot->step = step;
+    slot->vehicle = vehicle;
+}
+
+/* VI is in the center but could not move this step, because its next
+   cell is still taken or its turn came late. Its reservations were
+   made for the steps it should have taken, so what is left of its run
+   moves one step later; otherwise they would expire under it and a
+   crossing vehicle could be admitted onto cells it still needs. Slots
+   another vehicle holds already stay with that vehicle, occupancy
+   keeps the two apart. */
+void hold_center_run(struct vehicle_info* vi) {
+    struct position cells[RESERVATION_HORIZON];
+    int now = crossroads_step;
+    int route = get_vehicle_route(vi);
+    int count;
+
+    if (!deadlock_system || !is_intersection_position(vi->position)) {
+        return;
+    }
+
+    counted_lock_acquire(&deadlock_system->resource_order_lock,
+        &deadlock_system->resource_order_stats);
+    count = center_run(vi, cells);
+    hold_slot(vi->position, now + 1, vi->id);
+    for (int k = 0; k < count; k++) {
+        hold_slot(cells[k], now + 1 + k, vi->id);
+        hold_slot(cells[k], now + 2 + k, vi->id);
+    }
+    /* Keeps crossing routes off the lookup-free path in
+       reserve_center_run() while this vehicle is still inside */
+    if (safety_system->route_busy_until[route] < now + 1 + count) {
+        safety_system->route_busy_until[route] = now + 1 + count;
+    }
+    lock_release(&deadlock_system->resource_order_lock);
+}
+
+/* Drops every reservation VI holds from the current step on */
+static void cancel_center_run(struct vehicle_info* vi) {
+    for (int row = 0; row < MAP_MAX_SIZE; row++) {
+        for (int col = 0; col < MAP_MAX_SIZE; col++) {
+            for (int slot = 0; slot < RESERVATION_HORIZON; slot++) {
+                struct cell_reservation* res = &deadlock_system->reservations[row][col][slot];
+                if (res->vehicle == vi->id && res->step >= crossroads_step) {
+                    res->step = -1;
+                    res->vehicle = -1;
+                }
+            }
+        }
+    }
+}
+
+/* Records that the head of VI's approach is asking for the center
+   and returns its entry */
+static struct entry_waiter* note_entry_request(struct vehicle_info* vi) {
+    struct entry_waiter* w = &deadlock_system->entry_waiters[vi->start - 'A'];
+
+    if (w->vi != vi) {
+        w->vi = vi;
+        w->since = crossroads_step;
+    }
+    w->asked = crossroads_step;
+    return w;
+}
+
+static int entry_priority(const struct entry_waiter* w) {
+    return aged_priority(get_vehicle_priority(w->vi), w->since);
+}
+
+/* True if OTHER goes before W. Two ambulances are ordered earliest
+   deadline first: the one with less slack, counting the path still
+   to drive, wins. One that can no longer make it gives way to one
+   that still can. Everyone else is ordered by aged priority. Both
+   are recomputed on every request. */
+static bool entry_goes_before(const struct entry_waiter* other, const struct entry_waiter* w) {
+    if (other->vi->type == VEHICL_TYPE_AMBULANCE && w->vi->type == VEHICL_TYPE_AMBULANCE) {
+        int other_slack = vehicle_slack(other->vi);
+        int slack = vehicle_slack(w->vi);
+
+        if ((other_slack >= 0) != (slack >= 0)) {
+            return other_slack >= 0;
+        }
+        return other_slack < slack;
+    }
+    return entry_priority(other) > entry_priority(w);
+}
+
+/* True if a head of another approach, still asking and on a route
+   that crosses ours, goes before W. W then holds back so that the
+   cells it would take stay free for that vehicle. Waiters of equal
+   priority do not hold each other back, so nothing changes until
+   somebody has aged; the first waiter never defers and gets in as
+   soon as its path clears. */
+static bool must_defer(const struct entry_waiter* w) {
+    int route = get_vehicle_route(w->vi);
+
+    for (int i = 0; i < 4; i++) {
+        const struct entry_waiter* other = &deadlock_system->entry_waiters[i];
+
+        if (other == w || other->vi == NULL || other->asked < crossroads_step - 1) {
+            continue;   /* Empty, or no longer asking (red light, gave up) */
+        }
+        if (safety_system->conflicting_moves[route][get_vehicle_route(other->vi)] &&
+            entry_goes_before(other, w)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Admission to the center. A vehicle is admitted only if its whole
+   run through the center can be reserved in space and time, so it
+   never needs to be admitted again. If it falls behind once inside,
+   hold_center_run() keeps the rest of its run reserved.
+   Heads of approaches that cross are served in aged priority order,
+   so a steady stream from one side cannot starve the other. */
 bool can_enter_intersection(struct vehicle_info* vi, struct position next_pos) {
+    struct entry_waiter* w;
+    bool admitted;
+
     if (!deadlock_system) {
         return true;  /* If system not initialized, allow movement */
     }
@@ -107,21 +362,145 @@ bool can_enter_intersection(struct vehicle_info* vi, struct position next_pos) {
         return true;
     }
 
-    /* For ambulances in emergency, always allow */
-    if (vi->type == VEHICL_TYPE_AMBULANCE && (vi->golden_time - crossroads_step) <= 3) {
-        printf("[DEBUG] Emergency ambulance %c: allowed immediate access\n", vi->id);
-        return true;
+    counted_lock_acquire(&deadlock_system->resource_order_lock,
+        &deadlock_system->resource_order_stats);
+    w = note_entry_request(vi);
+    admitted = !must_defer(w) && reserve_center_run(vi);
+    if (admitted) {
+        record_entry_wait(crossroads_step - w->since);
+        w->vi = NULL;
     }
+    lock_release(&deadlock_system->resource_order_lock);
 
-    /* Simple capacity check - just try to get a slot */
-    int priority = get_vehicle_priority(vi);
-    if (priority_sema_try_down(&deadlock_system->intersection_capacity, priority)) {
-        printf("[DEBUG] %c: acquired intersection capacity\n", vi->id);
-        return true;
+    if (admitted) {
+        TRACE(TRACE_MOVES, TRACE_RESERVED, vi, 0, 0);
+    }
+    else {
+        TRACE(TRACE_MOVES, TRACE_NOT_FREE, vi, 0, 0);
     }
+    return admitted;
+}
 
-    printf("[DEBUG] %c: intersection at capacity\n", vi->id);
-    return false;
+/* Claims the next crossroads_options.wave_length cells of ambulance
+   VI's path for this step and the next. Normal vehicles outside the
+   wave are not let into those cells, nor admitted to the center over
+   them. A cell another ambulance with less slack has claimed is left
+   to that one. */
+void claim_green_wave(struct vehicle_info* vi) {
+    const struct position* path = vehicle_path[vi->start - 'A'][vi->dest - 'A'];
+    int slack = vehicle_slack(vi);
+
+    if (!deadlock_system || vi->type != VEHICL_TYPE_AMBULANCE) {
+        return;
+    }
+
+    counted_lock_acquire(&deadlock_system->resource_order_lock,
+        &deadlock_system->resource_order_stats);
+    for (int k = 0; k < crossroads_options.wave_length; k++) {
+        struct position pos = path[vi->path_step + k];
+        struct wave_claim* claim;
+        int owner;
+
+        if (pos.row == -1) {
+            break;
+        }
+        claim = &deadlock_system->wave[pos.row][pos.col];
+        owner = wave_owner(pos);
+        if (owner != -1 && owner != vi->id && claim->slack < slack) {
+            continue;
+        }
+        claim->vehicle = vi->id;
+        claim->until = crossroads_step + 1;
+        claim->slack = slack;
+    }
+    lock_release(&deadlock_system->resource_order_lock);
+}
+
+/* True if VI may not move from FROM to TO this step because TO is
+   kept clear for an ambulance. Read without the lock: a claim made
+   later in the same step is seen on the next one. */
+bool is_held_by_wave(struct vehicle_info* vi, struct position from, struct position to) {
+    if (!deadlock_system) {
+        return false;
+    }
+    return wave_blocks(vi, from, to);
+}
+
+/* Recovery: forgets everything admission has promised but not yet
+   handed out. Reservations of vehicles already in the center stay,
+   since they still drive through them; everything else, the entry
+   queue order and the green waves start over. */
+void reset_admission(struct list* vehicles) {
+    struct list_elem* e;
+
+    if (!deadlock_system) {
+        return;
+    }
+
+    counted_lock_acquire(&deadlock_system->resource_order_lock,
+        &deadlock_system->resource_order_stats);
+    for (e = list_begin(vehicles); e != list_end(vehicles); e = list_next(e)) {
+        struct vehicle_info* vi = list_entry(e, struct vehicle_info, elem);
+
+        if (vi->state != VEHICLE_STATUS_RUNNING || !is_intersection_position(vi->position)) {
+            cancel_center_run(vi);
+        }
+    }
+    for (int i = 0; i < 4; i++) {
+        deadlock_system->entry_waiters[i].vi = NULL;
+    }
+    for (int row = 0; row < MAP_MAX_SIZE; row++) {
+        for (int col = 0; col < MAP_MAX_SIZE; col++) {
+            deadlock_system->wave[row][col].until = -1;
+        }
+    }
+    lock_release(&deadlock_system->resource_order_lock);
+}
+
+/* Forgets VI as the head of its approach. Called before a finished
+   vehicle is freed, since it may have given up while asking. */
+void drop_entry_request(struct vehicle_info* vi) {
+    struct entry_waiter* w;
+
+    if (!deadlock_system) {
+        return;
+    }
+
+    w = &deadlock_system->entry_waiters[vi->start - 'A'];
+    counted_lock_acquire(&deadlock_system->resource_order_lock,
+        &deadlock_system->resource_order_stats);
+    if (w->vi == vi) {
+        w->vi = NULL;
+    }
+    lock_release(&deadlock_system->resource_order_lock);
+}
+
+/* Prints the entry queue and the live reservations */
+void dump_admission_state(void) {
+    int live = 0;
+
+    if (!deadlock_system) {
+        return;
+    }
+
+    for (int i = 0; i < 4; i++) {
+        struct entry_waiter* w = &deadlock_system->entry_waiters[i];
+
+        if (w->vi != NULL) {
+            printf("entry %c: %s waiting since step %d, last asked %d\n",
+                'A' + i, w->vi->name, w->since, w->asked);
+        }
+    }
+    for (int row = 0; row < MAP_MAX_SIZE; row++) {
+        for (int col = 0; col < MAP_MAX_SIZE; col++) {
+            for (int slot = 0; slot < RESERVATION_HORIZON; slot++) {
+                if (deadlock_system->reservations[row][col][slot].step >= crossroads_step) {
+                    live++;
+                }
+            }
+        }
+    }
+    printf("%d center reservations live\n", live);
 }
 
 bool check_resource_ordering(struct vehicle_info* vi, int required_zones[], int num_zones) {
@@ -135,26 +514,73 @@ bool acquire_zones_atomic(struct vehicle_info* vi, int zones[], int num_zones) {
 void release_zones(struct vehicle_info* vi, int zones[], int num_zones) {
     if (!deadlock_system) return;
 
-    /* Only release if we were in intersection */
+    /* Releasing the center gives back the unused reservations */
     for (int i = 0; i < num_zones; i++) {
         if (zones[i] == ZONE_CENTER) {
-            priority_sema_up(&deadlock_system->intersection_capacity);
-            printf("[DEBUG] %c: released intersection capacity\n", vi->id);
+            counted_lock_acquire(&deadlock_system->resource_order_lock,
+                &deadlock_system->resource_order_stats);
+            cancel_center_run(vi);
+            lock_release(&deadlock_system->resource_order_lock);
+            TRACE(TRACE_MOVES, TRACE_RELEASED, vi, 0, 0);
             break;
         }
     }
 }
 
+/* A move is safe if it does not enter a cell another vehicle holds
+   for this step. Inside the center that is guaranteed by admission. */
 bool is_safe_movement(struct position from, struct position to, struct vehicle_info* vi) {
-    return true;  /* Simplified safety check */
+    bool safe;
+
+    if (!deadlock_system || !is_intersection_position(to)) {
+        return true;
+    }
+    if (is_intersection_position(from)) {
+        return true;
+    }
+
+    counted_lock_acquire(&deadlock_system->resource_order_lock,
+        &deadlock_system->resource_order_stats);
+    safe = !has_active_conflict(get_vehicle_route(vi), crossroads_step) ||
+        !is_reserved_by_other(to, crossroads_step, vi->id);
+    lock_release(&deadlock_system->resource_order_lock);
+
+    return safe;
 }
 
 bool check_conflicting_paths(struct vehicle_info* vi1, struct vehicle_info* vi2) {
-    return false;  /* No conflicts in simplified version */
+    return safety_system->conflicting_moves[get_vehicle_route(vi1)][get_vehicle_route(vi2)];
 }
 
+/* Two routes conflict if their runs through the center, exit cell
+   included, share any cell. Opposing right turns and the like share
+   nothing and can be admitted together. */
 void update_conflict_matrix(void) {
-    /* No-op in simplified version */
+    cell_mask run[NUM_ROUTES];
+    int compatible = 0;
+
+    for (int route = 0; route < NUM_ROUTES; route++) {
+        const struct position* path = vehicle_path[route / 4][route % 4];
+        struct position cells[RESERVATION_HORIZON];
+        int count = path_center_run(path, route_info[route / 4][route % 4].center_step, cells);
+
+        run[route] = 0;
+        for (int i = 0; i < count; i++) {
+            run[route] |= CELL_BIT(cells[i]);
+        }
+    }
+
+    for (int a = 0; a < NUM_ROUTES; a++) {
+        for (int b = 0; b < NUM_ROUTES; b++) {
+            bool conflict = (run[a] & run[b]) != 0;
+
+            safety_system->conflicting_moves[a][b] = conflict;
+            compatible += !conflict;
+        }
+    }
+
+    printf("Conflict matrix: %d of %d route pairs compatible\n",
+        compatible, NUM_ROUTES * NUM_ROUTES);
 }
 
 int compare_resource_priority(int zone1, int zone2) {
@@ -181,13 +607,14 @@ bool handle_ambulance_priority(struct vehicle_info* vi, struct position next_pos
 
     int time_left = vi->golden_time - crossroads_step;
     if (time_left <= 3) {
-        printf("EMERGENCY: Ambulance %c has priority (time left: %d)\n", vi->id, time_left);
+        printf("EMERGENCY: Ambulance %s has priority (time left: %d)\n", vi->name, time_left);
         return true;
     }
 
     return false;
 }
 
+/* Keeps normal vehicles out of the ambulance's way for this step */
 void preempt_normal_vehicles(struct vehicle_info* ambulance) {
-    printf("EMERGENCY: Ambulance %c requesting priority access\n", ambulance->id);
+    claim_green_wave(ambulance);
 }
\ No newline at end of file
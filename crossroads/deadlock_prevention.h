@@ -5,6 +5,7 @@
 #include "projects/crossroads/position.h"
 #include "projects/crossroads/vehicle.h"
 #include "projects/crossroads/priority_sync.h"
+#include "projects/crossroads/lock_stats.h"
 #include "threads/synch.h"
 
 /* Zone definitions for intersection management */
@@ -24,19 +25,51 @@
 #define DIRECTION_RIGHT_TURN        5
 #define DIRECTION_U_TURN           6
 
+/* Routes, one per (start, dest) pair: start * 4 + dest */
+#define NUM_ROUTES                  16
+
+/* Steps ahead covered by the reservation table. Must exceed the
+   longest run of center cells on any path plus its exit cell: three
+   sides of the largest center a layout can have. */
+#define RESERVATION_HORIZON 24
+
+/* One (cell, step) slot of the reservation table */
+struct cell_reservation {
+    int step;       /* Unit step the slot currently describes */
+    int vehicle;    /* Owning vehicle id, -1 if free */
+};
+
+/* A cell kept clear for an ambulance coming through */
+struct wave_claim {
+    int vehicle;    /* Ambulance id, -1 if unclaimed */
+    int until;      /* Last step the claim holds */
+    int slack;      /* Slack of the ambulance when it claimed */
+};
+
+/* The vehicle at the head of an approach asking to enter the center */
+struct entry_waiter {
+    struct vehicle_info *vi;    /* NULL if nobody is waiting */
+    int since;                  /* Step of its first refused request */
+    int asked;                  /* Step of its latest request */
+};
+
 /* Deadlock prevention system structure */
 struct deadlock_prevention {
     struct priority_lock zone_locks[NUM_ZONES];     /* Zone-based locks */
-    struct priority_sema intersection_capacity;      /* Total intersection capacity */
+    struct cell_reservation reservations[MAP_MAX_SIZE][MAP_MAX_SIZE][RESERVATION_HORIZON]; /* Indexed by step % horizon */
+    struct entry_waiter entry_waiters[4];            /* Indexed by approach */
+    struct wave_claim wave[MAP_MAX_SIZE][MAP_MAX_SIZE]; /* Green wave ahead of ambulances */
     struct lock resource_order_lock;                 /* Lock for atomic operations */
+    struct lock_stats resource_order_stats;          /* Its contention counters */
     bool zones_occupied[NUM_ZONES];                  /* Zone occupation status */
     int zone_holders[NUM_ZONES];                     /* Vehicle ID holding each zone */
 };
 
 /* Intersection safety system structure */
 struct intersection_safety {
-    bool conflicting_moves[7][7];    /* Conflict matrix for movements */
-    struct lock safety_check_lock;   /* Lock for safety checks */
+    bool conflicting_moves[NUM_ROUTES][NUM_ROUTES]; /* Routes sharing a center run cell */
+    int route_busy_until[NUM_ROUTES];    /* Last step reserved by a vehicle on the route */
+    struct lock safety_check_lock;       /* Lock for safety checks */
 };
 
 /* Global system pointers */
@@ -52,9 +85,16 @@ void cleanup_deadlock_prevention(void);
 int get_zone_for_position(struct position pos);
 bool is_intersection_position(struct position pos);
 int get_movement_direction(struct position from, struct position to);
+int get_vehicle_route(struct vehicle_info *vi);
 
 /* Main deadlock prevention functions */
 bool can_enter_intersection(struct vehicle_info *vi, struct position next_pos);
+void hold_center_run(struct vehicle_info *vi);
+void claim_green_wave(struct vehicle_info *vi);
+bool is_held_by_wave(struct vehicle_info *vi, struct position from, struct position to);
+void reset_admission(struct list *vehicles);
+void drop_entry_request(struct vehicle_info *vi);
+void dump_admission_state(void);
 bool check_resource_ordering(struct vehicle_info *vi, int required_zones[], int num_zones);
 bool acquire_zones_atomic(struct vehicle_info *vi, int zones[], int num_zones);
 void release_zones(struct vehicle_info *vi, int zones[], int num_zones);
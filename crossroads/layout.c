@@ -0,0 +1,248 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "projects/crossroads/layout.h"
+#include <debug.h>
+
+static const struct map_layout builtin_layouts[] = {
+    /* The original crossroads */
+    { "default", 7, 2, 4, {
+        "XX X XX",
+        "XX X XX",
+        "   -   ",
+        "-------",
+        "   -   ",
+        "XX - XX",
+        "XX - XX",
+    } },
+    /* Single cell lanes around the same center */
+    { "small", 5, 1, 3, { NULL } },
+    /* A 4x4 center, three steps longer around */
+    { "wide", 8, 2, 5, { NULL } },
+    /* Three cell lanes into a 2x2 center */
+    { "long", 8, 3, 4, { NULL } },
+};
+
+#define BUILTIN_CNT ((int) (sizeof builtin_layouts / sizeof builtin_layouts[0]))
+
+/* Layout given as SIZE,LO,HI on the command line */
+static struct map_layout custom_layout;
+
+const struct map_layout* map_layout;
+struct position vehicle_path[4][4][MAP_MAX_PATH];
+struct route_info route_info[4][4];
+cell_mask center_cells;
+char map_background[MAP_MAX_SIZE][MAP_MAX_SIZE];
+
+/* Returns the layout called SPEC, or one built from SPEC as
+   "SIZE,LO,HI". NULL if SPEC is neither. */
+const struct map_layout* find_map_layout(const char* spec)
+{
+    char copy[32];
+    char* field[3];
+    char* saveptr;
+    int cnt = 0;
+
+    for (int i = 0; i < BUILTIN_CNT; i++) {
+        if (!strcmp(spec, builtin_layouts[i].name)) {
+            return &builtin_layouts[i];
+        }
+    }
+
+    strlcpy(copy, spec, sizeof copy);
+    for (char* token = strtok_r(copy, ",", &saveptr); token != NULL && cnt < 3;
+        token = strtok_r(NULL, ",", &saveptr)) {
+        field[cnt++] = token;
+    }
+    if (cnt != 3) {
+        return NULL;
+    }
+
+    memset(&custom_layout, 0, sizeof custom_layout);
+    custom_layout.name = "custom";
+    custom_layout.size = atoi(field[0]);
+    custom_layout.center_lo = atoi(field[1]);
+    custom_layout.center_hi = atoi(field[2]);
+    return &custom_layout;
+}
+
+static bool is_center(struct position pos)
+{
+    return pos.row >= map_layout->center_lo && pos.row <= map_layout->center_hi &&
+        pos.col >= map_layout->center_lo && pos.col <= map_layout->center_hi;
+}
+
+/* Next cell counterclockwise around the edge of the center */
+static struct position ring_next(struct position pos)
+{
+    int lo = map_layout->center_lo;
+    int hi = map_layout->center_hi;
+
+    if (pos.row == hi && pos.col < hi) {
+        pos.col++;
+    }
+    else if (pos.col == hi && pos.row > lo) {
+        pos.row--;
+    }
+    else if (pos.row == lo && pos.col > lo) {
+        pos.col--;
+    }
+    else {
+        pos.row++;
+    }
+    return pos;
+}
+
+/* Corner where traffic from approach A joins the center, and the one
+   where traffic for A leaves it */
+static struct position entry_corner(int a)
+{
+    int lo = map_layout->center_lo;
+    int hi = map_layout->center_hi;
+    struct position corners[4] = { { hi, lo }, { hi, hi }, { lo, hi }, { lo, lo } };
+
+    return corners[a];
+}
+
+static struct position exit_corner(int a)
+{
+    return entry_corner((a + 3) % 4);
+}
+
+/* One cell further out from the center, along the lane of approach A
+   that runs through POS */
+static struct position lane_out(int a, struct position pos)
+{
+    static const int drow[4] = { 0, 1, 0, -1 };
+    static const int dcol[4] = { -1, 0, 1, 0 };
+
+    pos.row += drow[a];
+    pos.col += dcol[a];
+    return pos;
+}
+
+static bool is_on_map(struct position pos)
+{
+    return pos.row >= 0 && pos.row < map_layout->size &&
+        pos.col >= 0 && pos.col < map_layout->size;
+}
+
+/* Stores the lane in to approach A's entry corner in CELLS, from the
+   edge of the map on, and returns its length */
+static int lane_in(int a, struct position cells[])
+{
+    struct position pos = entry_corner(a);
+    int cnt = 0;
+
+    for (pos = lane_out(a, pos); is_on_map(pos); pos = lane_out(a, pos)) {
+        cnt++;
+    }
+    pos = entry_corner(a);
+    for (int k = cnt; k > 0; k--) {
+        pos = lane_out(a, pos);
+        cells[k - 1] = pos;
+    }
+    return cnt;
+}
+
+static void compile_route(int start, int dest)
+{
+    struct position* path = vehicle_path[start][dest];
+    struct route_info* info = &route_info[start][dest];
+    struct position pos;
+    int len = lane_in(start, path);
+
+    /* Around the center to the exit corner */
+    info->center_step = len;
+    pos = entry_corner(start);
+    path[len++] = pos;
+    while (pos.row != exit_corner(dest).row || pos.col != exit_corner(dest).col) {
+        pos = ring_next(pos);
+        path[len++] = pos;
+    }
+
+    /* Out along the lane of the destination */
+    for (pos = lane_out(dest, pos); is_on_map(pos); pos = lane_out(dest, pos)) {
+        path[len++] = pos;
+    }
+
+    ASSERT(len < MAP_MAX_PATH);
+    path[len].row = path[len].col = -1;
+
+    info->length = len;
+    info->cells = 0;
+    for (int k = 0; k < len; k++) {
+        info->cells |= CELL_BIT(path[k]);
+    }
+}
+
+/* Background for a layout without art: road where some route drives,
+   a median between the lanes and inside the center, and blocks
+   elsewhere */
+static void draw_background(void)
+{
+    cell_mask road = 0;
+    int lo = map_layout->center_lo;
+    int hi = map_layout->center_hi;
+
+    for (int start = 0; start < 4; start++) {
+        for (int dest = 0; dest < 4; dest++) {
+            road |= route_info[start][dest].cells;
+        }
+    }
+
+    for (int row = 0; row < map_layout->size; row++) {
+        for (int col = 0; col < map_layout->size; col++) {
+            struct position pos = { row, col };
+
+            if (map_layout->art[0] != NULL) {
+                map_background[row][col] = map_layout->art[row][col];
+            }
+            else if (road & CELL_BIT(pos)) {
+                map_background[row][col] = ' ';
+            }
+            else if ((row > lo && row < hi) || (col > lo && col < hi)) {
+                map_background[row][col] = '-';
+            }
+            else {
+                map_background[row][col] = 'X';
+            }
+        }
+    }
+}
+
+/* Compiles the route tables of LAYOUT. Must run before anything looks
+   at vehicle_path. */
+void init_map_layout(const struct map_layout* layout)
+{
+    int size = layout->size;
+    int lo = layout->center_lo;
+    int hi = layout->center_hi;
+
+    /* Every approach needs a lane, and the center a corner for each */
+    if (size > MAP_MAX_SIZE || lo < 1 || hi <= lo || hi > size - 2) {
+        PANIC("bad map geometry: size %d, center %d..%d", size, lo, hi);
+    }
+    map_layout = layout;
+
+    center_cells = 0;
+    for (int row = 0; row < size; row++) {
+        for (int col = 0; col < size; col++) {
+            struct position pos = { row, col };
+
+            if (is_center(pos)) {
+                center_cells |= CELL_BIT(pos);
+            }
+        }
+    }
+
+    for (int start = 0; start < 4; start++) {
+        for (int dest = 0; dest < 4; dest++) {
+            compile_route(start, dest);
+        }
+    }
+    draw_background();
+
+    printf("Map %s: %dx%d, center %d..%d\n", layout->name, size, size, lo, hi);
+}
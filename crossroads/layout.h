@@ -0,0 +1,54 @@
+#ifndef __PROJECTS_CROSSROADS_LAYOUT_H__
+#define __PROJECTS_CROSSROADS_LAYOUT_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "projects/crossroads/position.h"
+
+/* Map geometry.
+
+   A map is a square of SIZE cells with a square center from row and
+   column CENTER_LO to CENTER_HI. Traffic drives on the right and goes
+   counterclockwise around the edge of the center, like the original
+   7x7 crossroads. Each approach A (west), B (south), C (east) and D
+   (north) has one lane in and one lane out. The lanes meet the
+   center at its corners. Every route is compiled once, at startup,
+   from those three numbers. The hot path then uses table lookups
+   instead of coordinate tests. */
+
+/* One bit per cell must fit in a cell_mask */
+#define MAP_MAX_SIZE 8
+
+/* Longest path, lanes and three sides of the center, plus the end
+   mark */
+#define MAP_MAX_PATH 24
+
+typedef uint64_t cell_mask;
+
+#define CELL_BIT(POS) ((cell_mask) 1 << ((POS).row * MAP_MAX_SIZE + (POS).col))
+
+struct map_layout {
+    const char *name;
+    int size;                       /* Rows and columns */
+    int center_lo;                  /* First row and column of the center */
+    int center_hi;                  /* Last row and column of the center */
+    const char *art[MAP_MAX_SIZE];  /* Background, or NULL to draw it from the geometry */
+};
+
+/* What the hot path needs to know about a route */
+struct route_info {
+    int length;                     /* Cells on the map */
+    int center_step;                /* Path index of its first center cell */
+    cell_mask cells;                /* Every cell it drives through */
+};
+
+extern const struct map_layout *map_layout;
+extern struct position vehicle_path[4][4][MAP_MAX_PATH];
+extern struct route_info route_info[4][4];
+extern cell_mask center_cells;
+extern char map_background[MAP_MAX_SIZE][MAP_MAX_SIZE];
+
+const struct map_layout *find_map_layout(const char *spec);
+void init_map_layout(const struct map_layout *layout);
+
+#endif /* __PROJECTS_CROSSROADS_LAYOUT_H__ */
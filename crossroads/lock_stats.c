@@ -0,0 +1,224 @@
+#include <stdio.h>
+#include <string.h>
+#include <debug.h>
+
+#include "projects/crossroads/lock_stats.h"
+#include "projects/crossroads/crossroads.h"
+#include "projects/crossroads/layout.h"
+#include "threads/thread.h"
+#include "threads/interrupt.h"
+#include "devices/timer.h"
+
+/* Registered locks, in registration order */
+static struct list locks;
+
+/* Claims and failed claims of each cell */
+static int64_t cell_claims[MAP_MAX_SIZE * MAP_MAX_SIZE];
+static int64_t cell_failures[MAP_MAX_SIZE * MAP_MAX_SIZE];
+
+void init_lock_stats(void)
+{
+    list_init(&locks);
+    for (int i = 0; i < MAP_MAX_SIZE * MAP_MAX_SIZE; i++) {
+        cell_claims[i] = 0;
+        cell_failures[i] = 0;
+    }
+}
+
+/* Clears STATS and adds it to the report as NAME */
+void lock_stats_register(struct lock_stats* stats, const char* name)
+{
+    strlcpy(stats->name, name, sizeof stats->name);
+    stats->acquisitions = 0;
+    stats->contended = 0;
+    stats->failed_tries = 0;
+    stats->wait_ticks = 0;
+    stats->max_wait_ticks = 0;
+    stats->holder[0] = '\0';
+    list_push_back(&locks, &stats->elem);
+}
+
+bool lock_stats_enabled(void)
+{
+    return crossroads_options.lock_stats;
+}
+
+/* Notes that the caller has to wait for HOLDER. Call with interrupts
+   off, so that HOLDER cannot go away meanwhile. */
+void lock_stats_contended(struct lock_stats* stats, const struct thread* holder)
+{
+    ASSERT(intr_get_level() == INTR_OFF);
+
+    stats->contended++;
+    if (holder != NULL) {
+        strlcpy(stats->holder, holder->name, sizeof stats->holder);
+    }
+    else {
+        /* Released but not yet handed over */
+        strlcpy(stats->holder, "?", sizeof stats->holder);
+    }
+}
+
+/* Counts an acquisition after WAIT_TICKS of waiting */
+void lock_stats_acquired(struct lock_stats* stats, int64_t wait_ticks)
+{
+    enum intr_level old_level = intr_disable();
+
+    stats->acquisitions++;
+    stats->wait_ticks += wait_ticks;
+    if (wait_ticks > stats->max_wait_ticks) {
+        stats->max_wait_ticks = wait_ticks;
+    }
+    intr_set_level(old_level);
+}
+
+void lock_stats_failed_try(struct lock_stats* stats)
+{
+    enum intr_level old_level = intr_disable();
+
+    stats->failed_tries++;
+    intr_set_level(old_level);
+}
+
+/* lock_acquire() that counts into STATS. A free lock is taken with
+   lock_try_acquire() first, so only real waits are timed. */
+void counted_lock_acquire(struct lock* lock, struct lock_stats* stats)
+{
+    enum intr_level old_level;
+    bool acquired;
+    int64_t start;
+
+    if (!lock_stats_enabled()) {
+        lock_acquire(lock);
+        return;
+    }
+
+    old_level = intr_disable();
+    acquired = lock_try_acquire(lock);
+    if (!acquired) {
+        lock_stats_contended(stats, lock->holder);
+    }
+    intr_set_level(old_level);
+
+    if (acquired) {
+        lock_stats_acquired(stats, 0);
+        return;
+    }
+
+    start = timer_ticks();
+    lock_acquire(lock);
+    lock_stats_acquired(stats, timer_elapsed(start));
+}
+
+/* lock_try_acquire() that counts into STATS */
+bool counted_lock_try_acquire(struct lock* lock, struct lock_stats* stats)
+{
+    enum intr_level old_level;
+    bool acquired;
+
+    if (!lock_stats_enabled()) {
+        return lock_try_acquire(lock);
+    }
+
+    old_level = intr_disable();
+    acquired = lock_try_acquire(lock);
+    if (!acquired) {
+        lock_stats_contended(stats, lock->holder);
+        stats->failed_tries++;
+    }
+    intr_set_level(old_level);
+
+    if (acquired) {
+        lock_stats_acquired(stats, 0);
+    }
+    return acquired;
+}
+
+/* Counts a claim of POS, CLAIMED tells if it was free */
+void count_cell_claim(struct position pos, bool claimed)
+{
+    enum intr_level old_level;
+
+    if (!lock_stats_enabled()) {
+        return;
+    }
+
+    old_level = intr_disable();
+    cell_claims[pos.row * MAP_MAX_SIZE + pos.col]++;
+    if (!claimed) {
+        cell_failures[pos.row * MAP_MAX_SIZE + pos.col]++;
+    }
+    intr_set_level(old_level);
+}
+
+static void print_cell_heatmap(void)
+{
+    int size = map_layout->size;
+    int64_t claims = 0, failures = 0, worst = 0;
+    struct position worst_pos = { 0, 0 };
+
+    printf("failed cell claims, by row and column:\n");
+    printf("   ");
+    for (int col = 0; col < size; col++) {
+        printf(" %6d", col);
+    }
+    printf("\n");
+    for (int row = 0; row < size; row++) {
+        printf("%2d ", row);
+        for (int col = 0; col < size; col++) {
+            int i = row * MAP_MAX_SIZE + col;
+
+            if (cell_claims[i] == 0) {
+                /* Not on any route */
+                printf(" %6s", ".");
+                continue;
+            }
+            printf(" %6lld", (long long) cell_failures[i]);
+            claims += cell_claims[i];
+            failures += cell_failures[i];
+            if (cell_failures[i] > worst) {
+                worst = cell_failures[i];
+                worst_pos.row = row;
+                worst_pos.col = col;
+            }
+        }
+        printf("\n");
+    }
+    printf("cell claims: %lld, failed: %lld", (long long) claims, (long long) failures);
+    if (worst > 0) {
+        printf(", hottest (%d,%d) failed %lld of %lld", worst_pos.row, worst_pos.col,
+            (long long) worst,
+            (long long) cell_claims[worst_pos.row * MAP_MAX_SIZE + worst_pos.col]);
+    }
+    printf("\n");
+}
+
+/* Prints the counters of every registered lock that was taken or
+   tried at all, and the cell heatmap. Locks nobody touched, like the
+   zone locks nothing acquires at the moment, are left out. Ticks are
+   10 ms, so most single waits count as 0. */
+void print_lock_stats(void)
+{
+    struct list_elem* e;
+
+    if (!lock_stats_enabled()) {
+        return;
+    }
+
+    printf("==== lock contention ====\n");
+    printf("%-15s %10s %10s %8s %10s %6s %s\n", "lock", "acquired", "contended",
+        "failed", "wait", "max", "last holder");
+    for (e = list_begin(&locks); e != list_end(&locks); e = list_next(e)) {
+        struct lock_stats* s = list_entry(e, struct lock_stats, elem);
+
+        if (s->acquisitions == 0 && s->failed_tries == 0) {
+            continue;
+        }
+        printf("%-15s %10lld %10lld %8lld %10lld %6lld %s\n", s->name,
+            (long long) s->acquisitions, (long long) s->contended,
+            (long long) s->failed_tries, (long long) s->wait_ticks,
+            (long long) s->max_wait_ticks, s->holder[0] != '\0' ? s->holder : "-");
+    }
+    print_cell_heatmap();
+    printf("=========================\n");
+}
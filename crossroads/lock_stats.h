@@ -0,0 +1,44 @@
+#ifndef __PROJECTS_CROSSROADS_LOCK_STATS_H__
+#define __PROJECTS_CROSSROADS_LOCK_STATS_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "lib/kernel/list.h"
+#include "threads/synch.h"
+#include "projects/crossroads/position.h"
+
+/* Lock contention profiling.
+
+   Run with -lockstats to count, per named lock, the acquisitions,
+   the ones that had to wait, failed try-acquires, and the ticks spent
+   waiting. The thread holding the lock the last time somebody had to
+   wait for it is kept too. Cells are claimed through the occupancy
+   bitmap rather than a lock each, so a failed claim_cell() counts as
+   contention on that cell, and the counts are printed as a heatmap of
+   the map. Without -lockstats every hook returns right away. */
+
+#define LOCK_NAME_LEN 15
+
+struct lock_stats {
+    char name[LOCK_NAME_LEN + 1];
+    int64_t acquisitions;
+    int64_t contended;              /* Acquisitions that had to wait */
+    int64_t failed_tries;           /* Try-acquires that gave up */
+    int64_t wait_ticks;             /* Total ticks spent waiting */
+    int64_t max_wait_ticks;
+    char holder[LOCK_NAME_LEN + 1]; /* Holder at the last contention, "" for none */
+    struct list_elem elem;          /* Registered locks */
+};
+
+void init_lock_stats(void);
+void lock_stats_register(struct lock_stats *stats, const char *name);
+bool lock_stats_enabled(void);
+void lock_stats_contended(struct lock_stats *stats, const struct thread *holder);
+void lock_stats_acquired(struct lock_stats *stats, int64_t wait_ticks);
+void lock_stats_failed_try(struct lock_stats *stats);
+void counted_lock_acquire(struct lock *lock, struct lock_stats *stats);
+bool counted_lock_try_acquire(struct lock *lock, struct lock_stats *stats);
+void count_cell_claim(struct position pos, bool claimed);
+void print_lock_stats(void);
+
+#endif /* __PROJECTS_CROSSROADS_LOCK_STATS_H__ */
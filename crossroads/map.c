@@ -1,5 +1,10 @@
 
+#include <stdarg.h>
+#include <stdbool.h>
+#include <string.h>
+#include "lib/kernel/stdio.h"
 #include "projects/crossroads/map.h"
+#include "projects/crossroads/layout.h"
 
 
 #define ANSI_NONE "\033[0m"
@@ -21,47 +26,110 @@
 #define ON_ANSI_CYAN "\033[46m"
 #define ON_ANSI_WHITE "\033[47m"
 
-#define clear() printf("\033[H\033[J")
-#define gotoxy(y,x) printf("\033[%d;%dH", (y), (x))
+#define clear() frame_printf("\033[H\033[J")
+#define gotoxy(y,x) frame_printf("\033[%d;%dH", (y), (x))
 
 
-const char map_draw_default[7][7] = {
-	{'X', 'X', ' ', 'X', ' ', 'X', 'X'}, 
-	{'X', 'X', ' ', 'X', ' ', 'X', 'X'}, 
-	{' ', ' ', ' ', '-', ' ', ' ', ' '}, 
-	{'-', '-', '-', '-', '-', '-', '-'}, 
-	{' ', ' ', ' ', '-', ' ', ' ', ' '}, 
-	{'X', 'X', ' ', '-', ' ', 'X', 'X'}, 
-	{'X', 'X', ' ', '-', ' ', 'X', 'X'}, 
-};
+/* Characters per cell on screen */
+#define CELL_WIDTH 2
 
+/* The frame being built, and the one on the screen. Only cells that
+   differ between the two are sent, and every frame goes out in a
+   single putbuf() so it does not interleave with other output. */
+static char frame_next[MAP_MAX_SIZE][MAP_MAX_SIZE][CELL_WIDTH];
+static char frame_shown[MAP_MAX_SIZE][MAP_MAX_SIZE][CELL_WIDTH];
+static bool frame_on_screen;
 
+/* Worst case is every cell changing, about 650 bytes */
+static char frame_buf[1024];
+static size_t frame_len;
+
+static void frame_printf(const char *format, ...)
+{
+	va_list args;
+	int n;
+
+	va_start(args, format);
+	n = vsnprintf(frame_buf + frame_len, sizeof frame_buf - frame_len, format, args);
+	va_end(args);
+
+	if (n > 0) {
+		frame_len += n;
+		if (frame_len >= sizeof frame_buf) {
+			frame_len = sizeof frame_buf - 1;
+		}
+	}
+}
+
+/* Starts a new frame with an empty map */
 void map_draw(void)
 {
 	int i, j;
 
-	clear();
+	for (i=0; i<MAP_MAX_SIZE; i++) {
+		for (j=0; j<MAP_MAX_SIZE; j++) {
+			frame_next[i][j][0] = map_background[i][j];
+			frame_next[i][j][1] = ' ';
+		}
+	}
+}
 
-	for (i=0; i<7; i++) {
-		for (j=0; j<7; j++) {
-			printf("%c ", map_draw_default[i][j]);
+/* A cell has room for two characters: short ids are drawn whole,
+   longer ones by their last two, so that E1, E10 and E11 or the
+   numbered generated vehicles still look different. Ids that end
+   in the same two characters look alike. */
+void map_draw_vehicle(const char *name, int row, int col)
+{
+	size_t len = strlen(name);
+
+	if (row >= 0 && col >= 0 && len > 0) {
+		if (len > CELL_WIDTH) {
+			name += len - CELL_WIDTH;
 		}
-		printf("\n");
+		frame_next[row][col][0] = name[0];
+		frame_next[row][col][1] = len > 1 ? name[1] : ' ';
 	}
-	printf("unit step: %d\n", crossroads_step);
-	gotoxy(0, 0);
 }
 
-void map_draw_vehicle(char id, int row, int col)
+/* Sends the frame: the whole map the first time, then only the
+   cells that changed since the last frame. */
+void map_draw_flush(void)
 {
-	if (row >= 0 && col >= 0) {
-		gotoxy(row + 1, col * 2 + 1);
-		printf("%c ", id);
-		gotoxy(0, 0);
+	int i, j;
+
+	frame_len = 0;
+
+	if (!frame_on_screen) {
+		clear();
+		for (i=0; i<map_layout->size; i++) {
+			for (j=0; j<map_layout->size; j++) {
+				frame_printf("%c%c", frame_next[i][j][0], frame_next[i][j][1]);
+			}
+			frame_printf("\n");
+		}
+		frame_on_screen = true;
+	} else {
+		for (i=0; i<map_layout->size; i++) {
+			for (j=0; j<map_layout->size; j++) {
+				if (memcmp(frame_next[i][j], frame_shown[i][j], CELL_WIDTH) != 0) {
+					gotoxy(i + 1, j * CELL_WIDTH + 1);
+					frame_printf("%c%c", frame_next[i][j][0], frame_next[i][j][1]);
+				}
+			}
+		}
+		gotoxy(map_layout->size + 1, 1);
 	}
+	frame_printf("unit step: %d", crossroads_step);
+	gotoxy(0, 0);
+
+	putbuf(frame_buf, frame_len);
+	memcpy(frame_shown, frame_next, sizeof frame_shown);
 }
 
 void map_draw_reset(void)
 {
+	frame_len = 0;
 	clear();
-}
\ No newline at end of file
+	putbuf(frame_buf, frame_len);
+	frame_on_screen = false;
+}
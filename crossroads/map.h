@@ -8,7 +8,8 @@
 extern int crossroads_step;
 
 void map_draw(void);
-void map_draw_vehicle(char id, int row, int col);
+void map_draw_vehicle(const char *name, int row, int col);
+void map_draw_flush(void);
 void map_draw_reset(void);
 
 #endif /* __PROJECTS_PROJECT2_MAPDATA_H__ */
\ No newline at end of file
@@ -0,0 +1,69 @@
+#include "projects/crossroads/occupancy.h"
+#include "projects/crossroads/lock_stats.h"
+#include "threads/interrupt.h"
+#include <debug.h>
+
+static cell_mask occupied;
+static struct vehicle_info* owners[MAP_MAX_SIZE * MAP_MAX_SIZE];
+
+void init_occupancy(void)
+{
+    occupied = 0;
+    for (int i = 0; i < MAP_MAX_SIZE * MAP_MAX_SIZE; i++) {
+        owners[i] = NULL;
+    }
+}
+
+/* Takes POS for VI if it is free */
+bool claim_cell(struct vehicle_info* vi, struct position pos)
+{
+    enum intr_level old_level;
+    bool claimed = false;
+
+    ASSERT(vi != NULL);
+
+    old_level = intr_disable();
+    if (!(occupied & CELL_BIT(pos))) {
+        occupied |= CELL_BIT(pos);
+        owners[pos.row * MAP_MAX_SIZE + pos.col] = vi;
+        claimed = true;
+    }
+    intr_set_level(old_level);
+    count_cell_claim(pos, claimed);
+
+    return claimed;
+}
+
+/* Gives back POS if VI holds it */
+void release_cell(struct vehicle_info* vi, struct position pos)
+{
+    enum intr_level old_level = intr_disable();
+
+    if (owners[pos.row * MAP_MAX_SIZE + pos.col] == vi) {
+        owners[pos.row * MAP_MAX_SIZE + pos.col] = NULL;
+        occupied &= ~CELL_BIT(pos);
+    }
+    intr_set_level(old_level);
+}
+
+/* Vehicle on POS, NULL if it is free */
+struct vehicle_info* cell_owner_at(struct position pos)
+{
+    return owners[pos.row * MAP_MAX_SIZE + pos.col];
+}
+
+cell_mask occupied_cells(void)
+{
+    return occupied;
+}
+
+int count_cells(cell_mask mask)
+{
+    int cnt = 0;
+
+    while (mask != 0) {
+        mask &= mask - 1;
+        cnt++;
+    }
+    return cnt;
+}
@@ -0,0 +1,27 @@
+#ifndef __PROJECTS_CROSSROADS_OCCUPANCY_H__
+#define __PROJECTS_CROSSROADS_OCCUPANCY_H__
+
+#include <stdbool.h>
+#include "projects/crossroads/position.h"
+#include "projects/crossroads/layout.h"
+#include "projects/crossroads/vehicle.h"
+
+/* Map occupancy.
+
+   Under the step-synchronous model a cell is only ever tested and
+   claimed, never waited on, so it needs no sleeping lock. The whole
+   map is one 64-bit word with a bit per cell, next to a flat table of
+   the vehicle on each cell for the wait-for graph and state dumps.
+   Cells are numbered row * MAP_MAX_SIZE + col whatever the layout.
+   Claims and releases run with interrupts off, which makes them
+   atomic on our uniprocessor. A cell belongs to a vehicle, not to a
+   thread, so any thread may release it for its owner. */
+
+void init_occupancy(void);
+bool claim_cell(struct vehicle_info *vi, struct position pos);
+void release_cell(struct vehicle_info *vi, struct position pos);
+struct vehicle_info *cell_owner_at(struct position pos);
+cell_mask occupied_cells(void);
+int count_cells(cell_mask mask);
+
+#endif /* __PROJECTS_CROSSROADS_OCCUPANCY_H__ */
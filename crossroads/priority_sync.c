@@ -1,7 +1,9 @@
 #include "projects/crossroads/priority_sync.h"
 #include "projects/crossroads/vehicle.h"
+#include "projects/crossroads/crossroads.h"
 #include "threads/thread.h"
 #include "threads/interrupt.h"
+#include "devices/timer.h"
 #include <stdio.h>
 
 extern int crossroads_step;
@@ -15,16 +17,102 @@ bool priority_waiter_less(const struct list_elem* a, const struct list_elem* b,
     return wa->priority > wb->priority;
 }
 
-// decide vehicle priority
+static void priority_queue_init(struct priority_queue* queue)
+{
+    for (int i = 0; i < PRIORITY_LEVELS; i++) {
+        list_init(&queue->levels[i]);
+    }
+    queue->nonempty = 0;
+}
+
+static bool priority_queue_empty(const struct priority_queue* queue)
+{
+    return queue->nonempty == 0;
+}
+
+// append to the FIFO of the waiter's level
+static void priority_queue_push(struct priority_queue* queue, struct priority_waiter* waiter)
+{
+    int level = waiter->priority;
+
+    if (level < PRIORITY_MIN) {
+        level = PRIORITY_MIN;
+    }
+    else if (level > PRIORITY_MAX) {
+        level = PRIORITY_MAX;
+    }
+    level -= PRIORITY_MIN;
+
+    list_push_back(&queue->levels[level], &waiter->elem);
+    queue->nonempty |= 1u << level;
+}
+
+// take the waiter with the highest aged priority. Each level is FIFO,
+// so only the head of each level needs to be looked at; on a tie the
+// higher base level wins.
+static struct priority_waiter* priority_queue_pop(struct priority_queue* queue)
+{
+    int level = -1;
+    int best = 0;
+    struct list_elem* e;
+
+    ASSERT(!priority_queue_empty(queue));
+
+    for (int i = PRIORITY_LEVELS - 1; i >= 0; i--) {
+        if (queue->nonempty & (1u << i)) {
+            struct priority_waiter* head = list_entry(list_front(&queue->levels[i]),
+                struct priority_waiter, elem);
+            int aged = aged_priority(head->priority, head->since);
+
+            if (level < 0 || aged > best) {
+                level = i;
+                best = aged;
+            }
+        }
+    }
+
+    e = list_pop_front(&queue->levels[level]);
+    if (list_empty(&queue->levels[level])) {
+        queue->nonempty &= ~(1u << level);
+    }
+    return list_entry(e, struct priority_waiter, elem);
+}
+
+// raise PRIORITY by one level every aging_steps steps waited since
+// SINCE, up to PRIORITY_MAX. Past max_wait steps the waiter goes
+// before everyone.
+int aged_priority(int priority, int since)
+{
+    int waited = crossroads_step - since;
+
+    if (crossroads_options.max_wait > 0 && waited >= crossroads_options.max_wait) {
+        return PRIORITY_STARVING;
+    }
+    if (crossroads_options.aging_steps > 0 && priority < PRIORITY_MAX) {
+        priority += waited / crossroads_options.aging_steps;
+        if (priority > PRIORITY_MAX) {
+            priority = PRIORITY_MAX;
+        }
+    }
+    return priority;
+}
+
+// decide vehicle priority. Ambulances are banded by slack, which
+// counts the path still to drive, so the result changes every step
+// and must not be cached.
 int get_vehicle_priority(struct vehicle_info* vi)
 {
     if (vi->type == VEHICL_TYPE_AMBULANCE) {
-        // ambulance: near to golden time 
-        int time_left = vi->golden_time - crossroads_step;
-        if (time_left <= 2) {
+        // ambulance: little slack left
+        int slack = vehicle_slack(vi);
+        if (slack < 0) {
+            // cannot make it any more, do not hold up the ones that can
+            return PRIORITY_AMBULANCE;
+        }
+        else if (slack <= 2) {
             return PRIORITY_AMBULANCE + 2;
         }
-        else if (time_left <= 5) {
+        else if (slack <= 5) {
             return PRIORITY_AMBULANCE + 1;
         }
         else {
@@ -40,7 +128,7 @@ void priority_sema_init(struct priority_sema* sema, int value)
     ASSERT(value >= 0);
 
     sema->value = value;
-    list_init(&sema->waiters);
+    priority_queue_init(&sema->waiters);
     lock_init(&sema->lock);
 }
 
@@ -55,6 +143,7 @@ void priority_sema_down(struct priority_sema* sema, int priority)
     // initialize waiter
     waiter.thread = thread_current();
     waiter.priority = priority;
+    waiter.since = crossroads_step;
     sema_init(&waiter.sema, 0);
 
     old_level = intr_disable();
@@ -67,7 +156,7 @@ void priority_sema_down(struct priority_sema* sema, int priority)
         return;
     }
 
-    list_insert_ordered(&sema->waiters, &waiter.elem, priority_waiter_less, NULL);
+    priority_queue_push(&sema->waiters, &waiter);
 
     lock_release(&sema->lock);
     intr_set_level(old_level);
@@ -106,8 +195,8 @@ void priority_sema_up(struct priority_sema* sema)
     old_level = intr_disable();
     lock_acquire(&sema->lock);
 
-    if (!list_empty(&sema->waiters)) {
-        waiter = list_entry(list_pop_front(&sema->waiters), struct priority_waiter, elem);
+    if (!priority_queue_empty(&sema->waiters)) {
+        waiter = priority_queue_pop(&sema->waiters);
         sema_up(&waiter->sema);
     }
     else {
@@ -118,16 +207,20 @@ void priority_sema_up(struct priority_sema* sema)
     intr_set_level(old_level);
 }
 
-void priority_lock_init(struct priority_lock* lock)
+void priority_lock_init(struct priority_lock* lock, const char* name)
 {
     ASSERT(lock != NULL);
 
     priority_sema_init(&lock->semaphore, 1);
     lock->holder = NULL;
+    lock_stats_register(&lock->stats, name);
 }
 
 void priority_lock_acquire(struct priority_lock* lock, int priority)
 {
+    enum intr_level old_level;
+    int64_t start;
+
     ASSERT(lock != NULL);
     ASSERT(!intr_context());
 
@@ -137,8 +230,27 @@ void priority_lock_acquire(struct priority_lock* lock, int priority)
         return;
     }
 
+    if (!lock_stats_enabled()) {
+        priority_sema_down(&lock->semaphore, priority);
+        lock->holder = thread_current();
+        return;
+    }
+
+    /* Only time the acquisitions that have to wait */
+    old_level = intr_disable();
+    if (priority_sema_try_down(&lock->semaphore, priority)) {
+        lock->holder = thread_current();
+        intr_set_level(old_level);
+        lock_stats_acquired(&lock->stats, 0);
+        return;
+    }
+    lock_stats_contended(&lock->stats, lock->holder);
+    intr_set_level(old_level);
+
+    start = timer_ticks();
     priority_sema_down(&lock->semaphore, priority);
     lock->holder = thread_current();
+    lock_stats_acquired(&lock->stats, timer_elapsed(start));
 }
 
 bool priority_lock_try_acquire(struct priority_lock* lock, int priority)
@@ -151,10 +263,25 @@ bool priority_lock_try_acquire(struct priority_lock* lock, int priority)
         return true;  /* Already have it */
     }
 
+    /* The holder is sampled along with the try, before it can go away */
+    enum intr_level old_level = intr_disable();
     bool success = priority_sema_try_down(&lock->semaphore, priority);
     if (success) {
         lock->holder = thread_current();
     }
+    else if (lock_stats_enabled()) {
+        lock_stats_contended(&lock->stats, lock->holder);
+    }
+    intr_set_level(old_level);
+
+    if (lock_stats_enabled()) {
+        if (success) {
+            lock_stats_acquired(&lock->stats, 0);
+        }
+        else {
+            lock_stats_failed_try(&lock->stats);
+        }
+    }
     return success;
 }
 
@@ -175,7 +302,7 @@ void priority_lock_release(struct priority_lock* lock)
 void priority_cond_init(struct priority_condition* cond)
 {
     ASSERT(cond != NULL);
-    list_init(&cond->waiters);
+    priority_queue_init(&cond->waiters);
 }
 
 void priority_cond_wait(struct priority_condition* cond, struct priority_lock* lock, int priority)
@@ -188,9 +315,10 @@ void priority_cond_wait(struct priority_condition* cond, struct priority_lock* l
 
     waiter.thread = thread_current();
     waiter.priority = priority;
+    waiter.since = crossroads_step;
     sema_init(&waiter.sema, 0);
 
-    list_insert_ordered(&cond->waiters, &waiter.elem, priority_waiter_less, NULL);
+    priority_queue_push(&cond->waiters, &waiter);
 
     priority_lock_release(lock);
     sema_down(&waiter.sema);
@@ -203,9 +331,8 @@ void priority_cond_signal(struct priority_condition* cond, struct priority_lock*
     ASSERT(lock != NULL);
     ASSERT(lock->holder == thread_current());
 
-    if (!list_empty(&cond->waiters)) {
-        struct priority_waiter* waiter = list_entry(list_pop_front(&cond->waiters),
-            struct priority_waiter, elem);
+    if (!priority_queue_empty(&cond->waiters)) {
+        struct priority_waiter* waiter = priority_queue_pop(&cond->waiters);
         sema_up(&waiter->sema);
     }
 }
@@ -216,7 +343,7 @@ void priority_cond_broadcast(struct priority_condition* cond, struct priority_lo
     ASSERT(lock != NULL);
     ASSERT(lock->holder == thread_current());
 
-    while (!list_empty(&cond->waiters)) {
+    while (!priority_queue_empty(&cond->waiters)) {
         priority_cond_signal(cond, lock);
     }
 }
\ No newline at end of file
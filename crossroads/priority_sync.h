@@ -4,6 +4,7 @@
 #include <stdbool.h>
 #include "threads/synch.h"
 #include "lib/kernel/list.h"
+#include "projects/crossroads/lock_stats.h"
 
 /* Forward declarations */
 struct vehicle_info;
@@ -13,22 +14,46 @@ struct vehicle_info;
 #define PRIORITY_TRAFFIC_LIGHT 2  
 #define PRIORITY_NORMAL_VEHICLE 1
 
+/* Range of waiter priorities, get_vehicle_priority() goes up to
+   PRIORITY_AMBULANCE + 2. Anything outside is clamped. */
+#define PRIORITY_MIN PRIORITY_NORMAL_VEHICLE
+#define PRIORITY_MAX (PRIORITY_AMBULANCE + 2)
+#define PRIORITY_LEVELS (PRIORITY_MAX - PRIORITY_MIN + 1)
+
+/* Aged priority of a waiter past crossroads_options.max_wait. Beats
+   every other priority, aging alone stops at PRIORITY_MAX. */
+#define PRIORITY_STARVING (PRIORITY_MAX + 1)
+
+/* Waiters bucketed by priority. One FIFO per level and a bitmap of
+   the non-empty levels, so push and pop take constant time and
+   waiters of equal priority are served in arrival order.
+
+   Nothing on the run path waits on a priority_sema or
+   priority_condition at the moment: cells go through the occupancy
+   map and admission through resource_order_lock. The queue is kept
+   for the priority_lock API. */
+struct priority_queue {
+    struct list levels[PRIORITY_LEVELS];    /* FIFO per priority */
+    unsigned nonempty;                      /* Bit i set if levels[i] has waiters */
+};
+
 /* Priority semaphore structure */
 struct priority_sema {
-    int value;              /* Semaphore value */
-    struct list waiters;    /* List of waiting threads */
-    struct lock lock;       /* Lock for internal use */
+    int value;                      /* Semaphore value */
+    struct priority_queue waiters;  /* Waiting threads */
+    struct lock lock;               /* Lock for internal use */
 };
 
 /* Priority lock structure */
 struct priority_lock {
     struct priority_sema semaphore; /* Internal semaphore */
     struct thread *holder;           /* Current holder */
+    struct lock_stats stats;         /* Contention counters, see lock_stats.h */
 };
 
 /* Priority condition variable */
 struct priority_condition {
-    struct list waiters;    /* List of waiting threads */
+    struct priority_queue waiters;  /* Waiting threads */
 };
 
 /* Waiter information structure */
@@ -36,6 +61,7 @@ struct priority_waiter {
     struct list_elem elem;      /* List element */
     struct thread *thread;      /* Waiting thread */
     int priority;               /* Thread priority */
+    int since;                  /* Unit step it started waiting */
     struct semaphore sema;      /* Private semaphore for signaling */
 };
 
@@ -46,7 +72,7 @@ bool priority_sema_try_down(struct priority_sema *sema, int priority);
 void priority_sema_up(struct priority_sema *sema);
 
 /* Priority lock functions */
-void priority_lock_init(struct priority_lock *lock);
+void priority_lock_init(struct priority_lock *lock, const char *name);
 void priority_lock_acquire(struct priority_lock *lock, int priority);
 bool priority_lock_try_acquire(struct priority_lock *lock, int priority);
 void priority_lock_release(struct priority_lock *lock);
@@ -59,6 +85,7 @@ void priority_cond_broadcast(struct priority_condition *cond, struct priority_lo
 
 /* Utility functions */
 int get_vehicle_priority(struct vehicle_info *vi);
+int aged_priority(int priority, int since);
 bool priority_waiter_less(const struct list_elem *a, const struct list_elem *b, void *aux);
 
 #endif /* __PROJECTS_CROSSROADS_PRIORITY_SYNC_H__ */
\ No newline at end of file
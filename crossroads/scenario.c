@@ -0,0 +1,197 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <random.h>
+
+#include "projects/crossroads/scenario.h"
+#include "projects/crossroads/crossroads.h"
+#include "projects/crossroads/trace.h"
+#include "projects/crossroads/watchdog.h"
+#include <debug.h>
+
+/* Vehicle list reader */
+static char* trace_saveptr;
+static char* trace_next;            /* Next token, NULL at the end */
+
+/* Generator */
+static int gen_step;                /* Next step to generate for */
+static struct vehicle_info gen_batch[4];
+static int gen_batch_cnt;
+static int gen_seq;
+
+static bool is_entry_point(char c)
+{
+    return c >= 'A' && c <= 'D';
+}
+
+/* Parses one vehicle token, ID START DEST [ARRIVAL[.GOLDEN_TIME]].
+   ID may be several characters long, so the token is read from the
+   right: an optional timing suffix, then the two entry points, and
+   whatever is left is the id. TOKEN is cut in place so that the id
+   can be used as the vehicle name. */
+static void parse_vehicle(struct vehicle_info* vi, char* token)
+{
+    char* end = token + strlen(token);
+    char* dot_pos = strchr(token, '.');
+
+    /* Default to normal vehicle */
+    vi->type = VEHICL_TYPE_NORMAL;
+    vi->arrival = 0;
+    vi->golden_time = -1;
+
+    if (dot_pos != NULL) {
+        /* Parse ambulance timing */
+        vi->type = VEHICL_TYPE_AMBULANCE;
+        vi->golden_time = atoi(dot_pos + 1);
+        end = dot_pos;
+    }
+    while (end > token && end[-1] >= '0' && end[-1] <= '9') {
+        end--;
+    }
+    vi->arrival = atoi(end);
+
+    if (end - token < 3 || !is_entry_point(end[-2]) || !is_entry_point(end[-1])) {
+        PANIC("malformed vehicle `%s'", token);
+    }
+
+    vi->start = end[-2];
+    vi->dest = end[-1];
+    end[-2] = '\0';
+    vi->name = token;
+}
+
+/* Fills VI from the next token if it is due by now */
+static bool next_from_list(struct vehicle_info* vi)
+{
+    char* end;
+    char* digits;
+
+    if (trace_next == NULL) {
+        return false;
+    }
+
+    /* Peek at the arrival without cutting the token, so it can wait
+       for a later step. An ambulance's arrival comes before the '.' */
+    end = strchr(trace_next, '.');
+    if (end == NULL) {
+        end = trace_next + strlen(trace_next);
+    }
+    digits = end;
+    while (digits > trace_next && digits[-1] >= '0' && digits[-1] <= '9') {
+        digits--;
+    }
+    if (atoi(digits) > crossroads_step) {
+        return false;
+    }
+
+    parse_vehicle(vi, trace_next);
+    trace_next = strtok_r(NULL, ":", &trace_saveptr);
+
+    /* Runs in the step barrier action, so no printf here */
+    TRACE(TRACE_EVENTS, TRACE_LET_IN, vi, vi->start, vi->dest);
+    return true;
+}
+
+/* Draws N with chance WEIGHTS[N] / sum of WEIGHTS */
+static int pick_weighted(const int weights[4])
+{
+    int total = 0;
+    int r;
+
+    for (int i = 0; i < 4; i++) {
+        total += weights[i];
+    }
+    r = random_ulong() % total;
+    for (int i = 0; i < 4; i++) {
+        if (r < weights[i]) {
+            return i;
+        }
+        r -= weights[i];
+    }
+    return 3;
+}
+
+/* Makes up the arrivals of gen_step */
+static void generate_batch(void)
+{
+    gen_batch_cnt = 0;
+    for (int a = 0; a < 4; a++) {
+        struct vehicle_info* vi = &gen_batch[gen_batch_cnt];
+        int turn;
+
+        if ((int) (random_ulong() % 100) >= crossroads_options.rates[a]) {
+            continue;
+        }
+
+        /* Right, straight, left and U-turn, counting counterclockwise */
+        turn = pick_weighted(crossroads_options.mix);
+        vi->start = 'A' + a;
+        vi->dest = 'A' + (a + 1 + turn) % 4;
+        vi->arrival = gen_step;
+        vi->golden_time = -1;
+        vi->type = VEHICL_TYPE_NORMAL;
+        if ((int) (random_ulong() % 100) < crossroads_options.ambulances) {
+            /* Twice the free-flow travel time to make it */
+            vi->type = VEHICL_TYPE_AMBULANCE;
+            vi->golden_time = gen_step + 2 * route_info[a][vi->dest - 'A'].length;
+        }
+        snprintf(vi->name_buf, sizeof vi->name_buf, "%c%d",
+            vi->type == VEHICL_TYPE_AMBULANCE ? 'A' + a : 'a' + a, gen_seq++);
+        gen_batch_cnt++;
+    }
+    gen_step++;
+}
+
+/* Fills VI from the generator if something arrives by now */
+static bool next_generated(struct vehicle_info* vi)
+{
+    while (gen_batch_cnt == 0 && gen_step <= crossroads_step &&
+        gen_step < crossroads_options.generate) {
+        generate_batch();
+    }
+    if (gen_batch_cnt == 0) {
+        return false;
+    }
+
+    *vi = gen_batch[--gen_batch_cnt];
+    vi->name = vi->name_buf;
+    return true;
+}
+
+/* VEHICLES is the ':'-separated vehicle list. It is tokenized in
+   place as the run goes and must outlive the vehicles, whose names
+   point into it. */
+void init_scenario(char* vehicles)
+{
+    trace_next = strtok_r(vehicles, ":", &trace_saveptr);
+
+    gen_step = 0;
+    gen_batch_cnt = 0;
+    gen_seq = 0;
+    if (crossroads_options.generate > 0) {
+        random_init(crossroads_options.seed);
+        printf("Generating traffic for %d steps, seed %d, rates %d/%d/%d/%d per 100 steps\n",
+            crossroads_options.generate, crossroads_options.seed,
+            crossroads_options.rates[0], crossroads_options.rates[1],
+            crossroads_options.rates[2], crossroads_options.rates[3]);
+    }
+}
+
+/* Fills VI with the next vehicle due by the current step. Only the
+   identity and timing are set. Returns false if nothing else
+   arrives this step. */
+bool scenario_next(struct vehicle_info* vi)
+{
+    return next_from_list(vi) || next_generated(vi);
+}
+
+/* True once every vehicle has arrived. A watchdog abort ends the
+   input too, whatever was still to come is never let in. */
+bool scenario_done(void)
+{
+    if (watchdog_aborted()) {
+        return true;
+    }
+    return trace_next == NULL && gen_batch_cnt == 0 &&
+        gen_step >= crossroads_options.generate;
+}
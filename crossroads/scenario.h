@@ -0,0 +1,30 @@
+#ifndef __PROJECTS_CROSSROADS_SCENARIO_H__
+#define __PROJECTS_CROSSROADS_SCENARIO_H__
+
+#include <stdbool.h>
+#include "projects/crossroads/vehicle.h"
+
+/* Where the vehicles come from.
+
+   The vehicle list on the command line is read one token at a time,
+   as the run reaches each vehicle's arrival, so it can be as long as
+   the command line allows. A vehicle may carry its arrival step,
+   "aAB12"; without one it arrives at step 0. An ambulance, "xAC3.30",
+   carries its golden time after the '.'. Ambulances stay in the
+   scenario until their arrival step like everyone else, and only then
+   take a slot. Tokens are expected in arrival order. A late one
+   arrives as soon as it is read. Each vehicle read is logged in the
+   trace, not printed.
+
+   With -generate=STEPS, a seeded generator adds traffic for that many
+   steps. Each step, approach A..D sends a vehicle with the chance set
+   by -rates, in vehicles per 100 steps. That makes the gaps between
+   arrivals geometric, the discrete form of Poisson arrivals. The
+   route is drawn from the right, straight, left and U-turn weights of
+   -mix, and -ambulances percent of them are ambulances. */
+
+void init_scenario(char *vehicles);
+bool scenario_next(struct vehicle_info *vi);
+bool scenario_done(void);
+
+#endif /* __PROJECTS_CROSSROADS_SCENARIO_H__ */
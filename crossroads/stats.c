@@ -0,0 +1,280 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "projects/crossroads/stats.h"
+#include "projects/crossroads/crossroads.h"
+#include "projects/crossroads/deadlock_prevention.h"
+#include "projects/crossroads/occupancy.h"
+#include "threads/interrupt.h"
+
+/* One per-vehicle counter, folded in as vehicles finish */
+struct vehicle_counter {
+    int total;
+    int max;                        /* -1 until a vehicle is counted */
+    int worst_id;                   /* Id of the vehicle with the max */
+    char worst[16];                 /* Name of the vehicle with the max */
+};
+
+static int vehicle_cnt;
+static int arrived, dropped;
+static struct vehicle_counter blocked, red_waits, travel;
+static int amb_on_time, amb_late, amb_gave_up;
+static int slack_total, slack_min;
+
+/* occupancy_hist[n] counts the steps that ended with n vehicles in
+   the center cells */
+static int occupancy_hist[STATS_MAX_OCCUPANCY + 1];
+static int sampled_steps;
+
+/* wait_hist[n] counts center admissions that came n steps after the
+   vehicle first asked */
+static int wait_hist[STATS_MAX_WAIT + 1];
+static int wait_cnt;
+
+/* delay_hist[n] counts vehicles that took n steps longer than their
+   route on an empty map, waiting for a slot included */
+static int delay_hist[STATS_MAX_WAIT + 1];
+static int delay_total;
+
+/* Circular waits broken, and waits given up because they could not
+   clear within the step. See wait_graph.h. */
+static int deadlocks;
+static int near_deadlocks;
+
+static void reset_counter(struct vehicle_counter* counter)
+{
+    counter->total = 0;
+    counter->max = -1;
+    counter->worst[0] = '\0';
+}
+
+static void count_value(struct vehicle_counter* counter, int value,
+    const struct vehicle_info* vi)
+{
+    counter->total += value;
+    /* Ties go to the earliest arrival, whatever order vehicles are
+       counted out in */
+    if (value > counter->max || (value == counter->max && vi->id < counter->worst_id)) {
+        counter->max = value;
+        counter->worst_id = vi->id;
+        strlcpy(counter->worst, vi->name, sizeof counter->worst);
+    }
+}
+
+void init_run_stats(void)
+{
+    int i;
+
+    vehicle_cnt = 0;
+    arrived = dropped = 0;
+    reset_counter(&blocked);
+    reset_counter(&red_waits);
+    reset_counter(&travel);
+    amb_on_time = amb_late = amb_gave_up = 0;
+    slack_total = slack_min = 0;
+    sampled_steps = 0;
+    for (i = 0; i <= STATS_MAX_OCCUPANCY; i++) {
+        occupancy_hist[i] = 0;
+    }
+    wait_cnt = 0;
+    delay_total = 0;
+    deadlocks = 0;
+    near_deadlocks = 0;
+    for (i = 0; i <= STATS_MAX_WAIT; i++) {
+        wait_hist[i] = 0;
+        delay_hist[i] = 0;
+    }
+}
+
+/* Records the state at the end of a unit step. Called from the step
+   barrier action, while every vehicle is parked. */
+void sample_step_stats(void)
+{
+    int occupancy = count_cells(occupied_cells() & center_cells);
+
+    if (occupancy > STATS_MAX_OCCUPANCY) {
+        occupancy = STATS_MAX_OCCUPANCY;
+    }
+    occupancy_hist[occupancy]++;
+    sampled_steps++;
+}
+
+/* Records how long a vehicle waited at the head of its approach
+   before being admitted to the center. Called with the admission
+   lock held. */
+void record_entry_wait(int steps)
+{
+    if (steps > STATS_MAX_WAIT) {
+        steps = STATS_MAX_WAIT;
+    }
+    wait_hist[steps]++;
+    wait_cnt++;
+}
+
+/* Called by vehicle threads, which may be preempted in the middle of
+   an increment, so interrupts are off for it */
+void record_deadlock(void)
+{
+    enum intr_level old_level = intr_disable();
+
+    deadlocks++;
+    intr_set_level(old_level);
+}
+
+void record_near_deadlock(void)
+{
+    enum intr_level old_level = intr_disable();
+
+    near_deadlocks++;
+    intr_set_level(old_level);
+}
+
+/* Folds in a vehicle that is done, before it is freed. Called from
+   the step barrier action. */
+void record_vehicle_done(const struct vehicle_info* vi)
+{
+    int slack, delay;
+
+    vehicle_cnt++;
+    count_value(&blocked, vi->blocked_steps, vi);
+    count_value(&red_waits, vi->red_wait_steps, vi);
+
+    if (vi->finish_step < 0) {
+        /* Never started, or an ambulance that gave up */
+        if (vi->type == VEHICL_TYPE_AMBULANCE) {
+            amb_gave_up++;
+        }
+        else {
+            dropped++;
+        }
+        return;
+    }
+
+    arrived++;
+    count_value(&travel, vi->finish_step - vi->arrival, vi);
+    delay = vi->finish_step - vi->arrival - route_info[vi->start - 'A'][vi->dest - 'A'].length;
+    if (delay < 0) {
+        delay = 0;  /* Keeps the histogram index in range */
+    }
+    delay_hist[delay < STATS_MAX_WAIT ? delay : STATS_MAX_WAIT]++;
+    delay_total += delay;
+
+    if (vi->type == VEHICL_TYPE_AMBULANCE) {
+        slack = vi->golden_time - vi->finish_step;
+        if (slack >= 0) {
+            amb_on_time++;
+        }
+        else {
+            amb_late++;
+        }
+        if (amb_on_time + amb_late == 1 || slack < slack_min) {
+            slack_min = slack;
+        }
+        slack_total += slack;
+    }
+}
+
+/* Smallest value that at least PERCENT of the CNT entries of HIST
+   did not exceed */
+static int percentile(const int hist[], int cnt, int percent)
+{
+    int target = (cnt * percent + 99) / 100;
+    int seen = 0;
+    int i;
+
+    for (i = 0; i < STATS_MAX_WAIT; i++) {
+        seen += hist[i];
+        if (seen >= target) {
+            break;
+        }
+    }
+    return i;
+}
+
+/* Fills SUMMARY with the headline numbers of the run so far */
+void get_run_summary(struct run_summary* summary)
+{
+    summary->steps = crossroads_step;
+    summary->arrived = arrived;
+    summary->delay_total = delay_total;
+    summary->delay_p99 = percentile(delay_hist, arrived, 99);
+    summary->ambulances = amb_on_time + amb_late + amb_gave_up;
+    summary->amb_on_time = amb_on_time;
+}
+
+/* Prints SUM / CNT with two decimals. The kernel is built without
+   floating point, so the mean is kept in hundredths. */
+static void print_mean(int sum, int cnt)
+{
+    int hundredths = cnt > 0 ? sum * 100 / cnt : 0;
+
+    if (hundredths < 0) {
+        printf("-");
+        hundredths = -hundredths;
+    }
+    printf("%d.%02d", hundredths / 100, hundredths % 100);
+}
+
+/* Prints the total, mean and worst vehicle of one per-vehicle counter */
+static void print_counter(const char* label, const struct vehicle_counter* counter,
+    int cnt)
+{
+    printf("%-18s total %6d  mean ", label, counter->total);
+    print_mean(counter->total, cnt);
+    if (counter->max >= 0) {
+        printf("  max %d (%s)", counter->max, counter->worst);
+    }
+    printf("\n");
+}
+
+void print_run_report(void)
+{
+    int i;
+
+    printf("==== crossroads run report ====\n");
+    printf("%-18s %d\n", "steps", crossroads_step);
+    printf("%-18s %d arrived, %d dropped, %d gave up\n", "vehicles",
+        arrived, dropped, amb_gave_up);
+    printf("%-18s ", "throughput");
+    print_mean(arrived * 100, crossroads_step);
+    printf(" vehicles per 100 steps\n");
+    print_counter("blocked steps", &blocked, vehicle_cnt);
+    print_counter("red light waits", &red_waits, vehicle_cnt);
+    print_counter("travel steps", &travel, arrived);
+
+    if (amb_on_time + amb_late + amb_gave_up > 0) {
+        printf("%-18s %d on time, %d late, %d gave up", "ambulances",
+            amb_on_time, amb_late, amb_gave_up);
+        if (amb_on_time + amb_late > 0) {
+            printf("  slack min %d mean ", slack_min);
+            print_mean(slack_total, amb_on_time + amb_late);
+        }
+        printf("\n");
+    }
+
+    if (wait_cnt > 0) {
+        printf("%-18s p50 %d  p95 %d  p99 %d  max %d%s  (%d admissions)\n",
+            "entry wait", percentile(wait_hist, wait_cnt, 50),
+            percentile(wait_hist, wait_cnt, 95), percentile(wait_hist, wait_cnt, 99),
+            percentile(wait_hist, wait_cnt, 100),
+            wait_hist[STATS_MAX_WAIT] > 0 ? "+" : "", wait_cnt);
+    }
+
+    if (arrived > 0) {
+        printf("%-18s p50 %d  p95 %d  p99 %d  max %d%s\n", "delay",
+            percentile(delay_hist, arrived, 50), percentile(delay_hist, arrived, 95),
+            percentile(delay_hist, arrived, 99), percentile(delay_hist, arrived, 100),
+            delay_hist[STATS_MAX_WAIT] > 0 ? "+" : "");
+    }
+
+    printf("%-18s %d broken, %d near\n", "deadlocks", deadlocks, near_deadlocks);
+
+    printf("%-18s", "center occupancy");
+    for (i = 0; i <= STATS_MAX_OCCUPANCY; i++) {
+        if (occupancy_hist[i] > 0) {
+            printf(" %d:%d", i, occupancy_hist[i]);
+        }
+    }
+    printf("  (vehicles:steps over %d steps)\n", sampled_steps);
+    printf("===============================\n");
+}
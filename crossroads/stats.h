@@ -0,0 +1,31 @@
+#ifndef __PROJECTS_CROSSROADS_STATS_H__
+#define __PROJECTS_CROSSROADS_STATS_H__
+
+#include "projects/crossroads/vehicle.h"
+
+/* Most vehicles the center cells of any layout can hold at once */
+#define STATS_MAX_OCCUPANCY ((MAP_MAX_SIZE - 2) * (MAP_MAX_SIZE - 2))
+
+/* Entry waits of this many steps or more share the last bucket */
+#define STATS_MAX_WAIT 256
+
+/* Headline numbers of a run, for the benchmark check */
+struct run_summary {
+    int steps;
+    int arrived;
+    int delay_total;                /* Steps lost over all arrived vehicles */
+    int delay_p99;
+    int ambulances;
+    int amb_on_time;
+};
+
+void init_run_stats(void);
+void sample_step_stats(void);
+void record_entry_wait(int steps);
+void record_deadlock(void);
+void record_near_deadlock(void);
+void record_vehicle_done(const struct vehicle_info *vi);
+void print_run_report(void);
+void get_run_summary(struct run_summary *summary);
+
+#endif /* __PROJECTS_CROSSROADS_STATS_H__ */
@@ -0,0 +1,147 @@
+#include "projects/crossroads/step_barrier.h"
+#include "threads/thread.h"
+#include "threads/interrupt.h"
+#include <debug.h>
+
+/* One blocked thread, lives on the waiter's stack */
+struct barrier_waiter {
+    struct list_elem elem;
+    struct thread *thread;
+};
+
+void step_barrier_init(struct step_barrier* barrier, int parties,
+    step_barrier_action* action, void* aux)
+{
+    ASSERT(barrier != NULL);
+    ASSERT(parties >= 0);
+
+    barrier->parties = parties;
+    barrier->arrived = 0;
+    barrier->sense = false;
+    barrier->completing = false;
+    list_init(&barrier->waiters);
+    barrier->action = action;
+    barrier->aux = aux;
+}
+
+/* Completes the current round. Must be called with interrupts off
+   once every party has arrived; returns with interrupts off. */
+static void complete_round(struct step_barrier* barrier)
+{
+    ASSERT(intr_get_level() == INTR_OFF);
+
+    /* Nobody else can arrive or leave until the waiters are
+       released, so the action may run with interrupts on */
+    if (barrier->action != NULL) {
+        barrier->completing = true;
+        intr_enable();
+        barrier->action(barrier->aux);
+        intr_disable();
+        barrier->completing = false;
+    }
+
+    barrier->arrived = 0;
+    barrier->sense = !barrier->sense;
+
+    while (!list_empty(&barrier->waiters)) {
+        struct barrier_waiter* waiter = list_entry(list_pop_front(&barrier->waiters),
+            struct barrier_waiter, elem);
+        thread_unblock(waiter->thread);
+    }
+}
+
+/* Waits until all parties have arrived. LOCAL_SENSE is the caller's
+   private copy of the barrier sense and must start out equal to the
+   barrier's. */
+void step_barrier_wait(struct step_barrier* barrier, bool* local_sense)
+{
+    enum intr_level old_level;
+
+    ASSERT(barrier != NULL);
+    ASSERT(local_sense != NULL);
+    ASSERT(!intr_context());
+
+    *local_sense = !*local_sense;
+
+    old_level = intr_disable();
+
+    barrier->arrived++;
+    if (barrier->arrived >= barrier->parties) {
+        complete_round(barrier);
+    }
+    else {
+        struct barrier_waiter waiter;
+
+        waiter.thread = thread_current();
+        while (barrier->sense != *local_sense) {
+            list_push_back(&barrier->waiters, &waiter.elem);
+            thread_block();
+        }
+    }
+
+    intr_set_level(old_level);
+}
+
+/* Drops the caller from the barrier for good. If everyone else has
+   already arrived, the caller completes their round. Returns the
+   number of parties left. */
+int step_barrier_leave(struct step_barrier* barrier)
+{
+    enum intr_level old_level;
+    int parties;
+
+    ASSERT(barrier != NULL);
+    ASSERT(!intr_context());
+
+    old_level = intr_disable();
+
+    ASSERT(barrier->parties > 0);
+    barrier->parties--;
+    if (barrier->parties > 0 && barrier->arrived >= barrier->parties) {
+        complete_round(barrier);
+    }
+    parties = barrier->parties;
+
+    intr_set_level(old_level);
+
+    return parties;
+}
+
+/* Adds CNT parties, or drops them if CNT is negative. No round may
+   complete meanwhile: call it from the action, or while the caller
+   is a party that has not arrived yet. */
+void step_barrier_join(struct step_barrier* barrier, int cnt)
+{
+    enum intr_level old_level;
+
+    ASSERT(barrier != NULL);
+
+    old_level = intr_disable();
+    barrier->parties += cnt;
+    ASSERT(barrier->parties >= 0);
+    intr_set_level(old_level);
+}
+
+/* Sets LOCAL_SENSE for a party that was just counted in. If it was
+   started from the action, waits until the round is over, so that
+   its first step is the next one. */
+void step_barrier_enter(struct step_barrier* barrier, bool* local_sense)
+{
+    enum intr_level old_level;
+    struct barrier_waiter waiter;
+
+    ASSERT(barrier != NULL);
+    ASSERT(local_sense != NULL);
+    ASSERT(!intr_context());
+
+    old_level = intr_disable();
+
+    waiter.thread = thread_current();
+    while (barrier->completing) {
+        list_push_back(&barrier->waiters, &waiter.elem);
+        thread_block();
+    }
+    *local_sense = barrier->sense;
+
+    intr_set_level(old_level);
+}
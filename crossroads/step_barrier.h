@@ -0,0 +1,40 @@
+#ifndef __PROJECTS_CROSSROADS_STEP_BARRIER_H__
+#define __PROJECTS_CROSSROADS_STEP_BARRIER_H__
+
+#include <stdbool.h>
+#include "lib/kernel/list.h"
+
+/* Called by the thread that completes a round, before anyone is
+   released. Runs with interrupts enabled and may sleep. */
+typedef void step_barrier_action(void *aux);
+
+/* Reusable sense-reversing barrier.
+
+   Arrivals only bump a counter with interrupts off and block; the
+   last arrival runs the action, flips the sense and unblocks every
+   waiter in one pass. Woken threads do not touch any shared lock on
+   the way out, so releasing n threads costs n wakeups and no
+   serialized lock handoffs.
+
+   Parties may join between rounds: whoever starts a new party counts
+   it in with step_barrier_join() first, and the new thread picks up
+   the current sense with step_barrier_enter() before its first
+   wait. */
+struct step_barrier {
+    int parties;                    /* Threads taking part in each round */
+    int arrived;                    /* Arrivals in the current round */
+    bool sense;                     /* Flipped every time a round completes */
+    bool completing;                /* The action of a round is running */
+    struct list waiters;            /* Threads blocked in the current round */
+    step_barrier_action *action;    /* Round completion hook, may be NULL */
+    void *aux;                      /* Argument for the action */
+};
+
+void step_barrier_init(struct step_barrier *barrier, int parties,
+    step_barrier_action *action, void *aux);
+void step_barrier_wait(struct step_barrier *barrier, bool *local_sense);
+int step_barrier_leave(struct step_barrier *barrier);
+void step_barrier_join(struct step_barrier *barrier, int cnt);
+void step_barrier_enter(struct step_barrier *barrier, bool *local_sense);
+
+#endif /* __PROJECTS_CROSSROADS_STEP_BARRIER_H__ */
@@ -0,0 +1,80 @@
+#include <stdio.h>
+
+#include "projects/crossroads/step_timing.h"
+#include "threads/interrupt.h"
+
+/* One phase. Totals are 64-bit, a long run adds up many samples. */
+struct phase_timing {
+    int64_t samples;
+    int64_t total;
+    int64_t min;
+    int64_t max;
+};
+
+static const char* phase_names[TIMING_PHASE_CNT] = {
+    "vehicle step",
+    "signal check",
+    "admission",
+    "cell claim",
+    "barrier wait",
+    "step action",
+    "signal plan",
+    "draw",
+};
+
+static struct phase_timing phases[TIMING_PHASE_CNT];
+
+void init_step_timing(void)
+{
+    for (int i = 0; i < TIMING_PHASE_CNT; i++) {
+        phases[i].samples = 0;
+        phases[i].total = 0;
+        phases[i].min = INT64_MAX;
+        phases[i].max = 0;
+    }
+}
+
+/* Adds one sample of TICKS to PHASE. Interrupts are off only for the
+   update, like trace_record(). */
+void timing_record(enum timing_phase phase, int64_t ticks)
+{
+    struct phase_timing* t = &phases[phase];
+    enum intr_level old_level;
+
+    old_level = intr_disable();
+    t->samples++;
+    t->total += ticks;
+    if (ticks < t->min) {
+        t->min = ticks;
+    }
+    if (ticks > t->max) {
+        t->max = ticks;
+    }
+    intr_set_level(old_level);
+}
+
+/* Prints the phases that were sampled. The mean is in thousandths of
+   a tick, since the kernel has no floating point. */
+void print_step_timing(void)
+{
+    if (!STEP_TIMING) {
+        return;
+    }
+
+    printf("==== step timing (ticks) ====\n");
+    printf("%-14s %10s %6s %10s %6s %10s\n", "phase", "samples", "min", "mean", "max", "total");
+    for (int i = 0; i < TIMING_PHASE_CNT; i++) {
+        const struct phase_timing* t = &phases[i];
+        int64_t mean;
+
+        if (t->samples == 0) {
+            continue;
+        }
+        mean = t->total * 1000 / t->samples;
+        printf("%-14s %10lld %6lld %6lld.%03lld %6lld %10lld\n", phase_names[i],
+            (long long) t->samples, (long long) t->min,
+            (long long) (mean / 1000), (long long) (mean % 1000),
+            (long long) t->max, (long long) t->total);
+    }
+    printf("=============================\n");
+}
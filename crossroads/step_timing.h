@@ -0,0 +1,43 @@
+#ifndef __PROJECTS_CROSSROADS_STEP_TIMING_H__
+#define __PROJECTS_CROSSROADS_STEP_TIMING_H__
+
+#include <stdint.h>
+
+/* Per-phase step timing.
+
+   Build with -DSTEP_TIMING=1 to record the timer_ticks() spent in
+   each phase of a unit step. The minimum, mean and maximum per phase
+   are printed at shutdown. A tick is 10 ms, much longer than most
+   phases, so single samples are mostly 0 or 1. The mean over many
+   samples is still a fair estimate of the share of time a phase takes.
+   Without STEP_TIMING the macros compile to nothing. */
+#ifndef STEP_TIMING
+#define STEP_TIMING 0
+#endif
+
+enum timing_phase {
+    TIMING_VEHICLE_STEP,    /* vehicle_step(), the whole turn of a vehicle */
+    TIMING_SIGNAL_CHECK,    /* Asking the light, in try_move() */
+    TIMING_ADMISSION,       /* Center admission, lock included */
+    TIMING_CELL_CLAIM,      /* Taking the next cell */
+    TIMING_BARRIER_WAIT,    /* Parked at the step barrier */
+    TIMING_STEP_ACTION,     /* Step barrier action, signal plan included */
+    TIMING_SIGNAL_PLAN,     /* Controller applying the signal plan */
+    TIMING_DRAW,            /* Drawing a frame of the map */
+    TIMING_PHASE_CNT
+};
+
+#if STEP_TIMING
+#include "devices/timer.h"
+#define TIMING_NOW() timer_ticks()
+#define TIMING_RECORD(PHASE, START) timing_record((PHASE), timer_ticks() - (START))
+#else
+#define TIMING_NOW() ((int64_t) 0)
+#define TIMING_RECORD(PHASE, START) ((void) (START))
+#endif
+
+void init_step_timing(void);
+void timing_record(enum timing_phase phase, int64_t ticks);
+void print_step_timing(void);
+
+#endif /* __PROJECTS_CROSSROADS_STEP_TIMING_H__ */
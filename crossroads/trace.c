@@ -0,0 +1,121 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "projects/crossroads/trace.h"
+#include "threads/interrupt.h"
+
+static struct trace_record trace_ring[TRACE_RING_SIZE];
+static unsigned trace_head;             /* Records written so far */
+
+void trace_init(void)
+{
+    trace_head = 0;
+}
+
+/* Appends an event to the ring. Interrupts are turned off only for
+   the copy, so recording never sleeps and never formats. */
+void trace_record(enum trace_type type, const struct vehicle_info* vi,
+    int a, int b)
+{
+    enum intr_level old_level;
+    struct trace_record* rec;
+
+    old_level = intr_disable();
+    rec = &trace_ring[trace_head++ & (TRACE_RING_SIZE - 1)];
+    rec->step = crossroads_step;
+    strlcpy(rec->name, vi != NULL ? vi->name : "", sizeof rec->name);
+    rec->type = type;
+    rec->a = a;
+    rec->b = b;
+    intr_set_level(old_level);
+}
+
+static void print_record(const struct trace_record* rec)
+{
+    printf("[%5d] %-6s ", rec->step, rec->name[0] != '\0' ? rec->name : "-");
+
+    switch (rec->type) {
+    case TRACE_STARTED:
+        printf("started\n");
+        break;
+    case TRACE_LET_IN:
+        printf("let in, %c->%c\n", rec->a, rec->b);
+        break;
+    case TRACE_MOVE:
+        printf("move to (%d,%d)\n", rec->a, rec->b);
+        break;
+    case TRACE_BLOCKED:
+        printf("blocked at path step %d\n", rec->a);
+        break;
+    case TRACE_RED_LIGHT:
+        printf("red light at (%d,%d)\n", rec->a, rec->b);
+        break;
+    case TRACE_RESERVED:
+        printf("reserved path through intersection\n");
+        break;
+    case TRACE_NOT_FREE:
+        printf("intersection path not free\n");
+        break;
+    case TRACE_RELEASED:
+        printf("released intersection reservation\n");
+        break;
+    case TRACE_WAVE_HOLD:
+        printf("held out of (%d,%d) for an ambulance\n", rec->a, rec->b);
+        break;
+    case TRACE_NEAR_DEADLOCK:
+        printf("stopped waiting for (%d,%d), holder is parked\n", rec->a, rec->b);
+        break;
+    case TRACE_DEADLOCK:
+        printf("backed off a circular wait for (%d,%d)\n", rec->a, rec->b);
+        break;
+    case TRACE_ARRIVED:
+        printf("arrived at destination\n");
+        break;
+    case TRACE_LIGHT:
+        printf("light %s green\n", rec->a == 0 ? "north-south" : "east-west");
+        break;
+    case TRACE_AMB_STANDBY:
+        printf("ambulance standby, %d steps until dispatch\n", rec->a);
+        break;
+    case TRACE_AMB_DISPATCHED:
+        printf("ambulance dispatched\n");
+        break;
+    case TRACE_AMB_URGENT:
+        printf("ambulance urgent, %d steps left\n", rec->a);
+        break;
+    case TRACE_AMB_ON_TIME:
+        printf("ambulance arrived in time\n");
+        break;
+    case TRACE_AMB_LATE:
+        printf("ambulance arrived too late\n");
+        break;
+    case TRACE_AMB_GAVE_UP:
+        printf("ambulance missed golden time\n");
+        break;
+    case TRACE_AMB_PREEMPT:
+        printf("ambulance preempts the light, %s green\n",
+            rec->a == 0 ? "north-south" : "east-west");
+        break;
+    default:
+        printf("event %d (%d,%d)\n", rec->type, rec->a, rec->b);
+        break;
+    }
+}
+
+/* Prints the records still in the ring, oldest first. May be called
+   at any time; events recorded while dumping may be lost. */
+void trace_dump(void)
+{
+    unsigned head = trace_head;
+    unsigned first = head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0;
+    unsigned i;
+
+    if (crossroads_options.trace_level == TRACE_OFF) {
+        return;
+    }
+
+    printf("==== trace: %u events, %u overwritten ====\n", head, first);
+    for (i = first; i < head; i++) {
+        print_record(&trace_ring[i & (TRACE_RING_SIZE - 1)]);
+    }
+}
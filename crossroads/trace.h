@@ -0,0 +1,71 @@
+#ifndef __PROJECTS_CROSSROADS_TRACE_H__
+#define __PROJECTS_CROSSROADS_TRACE_H__
+
+#include "projects/crossroads/crossroads.h"
+#include "projects/crossroads/vehicle.h"
+
+/* Trace levels. Events above TRACE_LEVEL_MAX are compiled out,
+   events above crossroads_options.trace_level are dropped at run
+   time before anything is recorded. */
+#define TRACE_OFF       0
+#define TRACE_EVENTS    1       /* Light changes, ambulance state */
+#define TRACE_MOVES     2       /* Every move, block and reservation */
+
+#ifndef TRACE_LEVEL_MAX
+#define TRACE_LEVEL_MAX TRACE_MOVES
+#endif
+
+/* Records kept, oldest are overwritten. Must be a power of two. */
+#define TRACE_RING_SIZE 4096
+
+enum trace_type {
+    TRACE_STARTED,          /* Thread started */
+    TRACE_LET_IN,           /* Read from the vehicle list, a -> b */
+    TRACE_MOVE,             /* Moved to (a,b) */
+    TRACE_BLOCKED,          /* Could not move, a = path step */
+    TRACE_RED_LIGHT,        /* Held at (a,b) by a red light */
+    TRACE_RESERVED,         /* Center path reserved */
+    TRACE_NOT_FREE,         /* Center path not free */
+    TRACE_RELEASED,         /* Center reservation given back */
+    TRACE_WAVE_HOLD,        /* Kept out of (a,b) for an ambulance */
+    TRACE_NEAR_DEADLOCK,    /* Gave up waiting for (a,b), holder parked */
+    TRACE_DEADLOCK,         /* Backed off a circular wait for (a,b) */
+    TRACE_ARRIVED,          /* Left the map at its destination */
+    TRACE_LIGHT,            /* Signal phase changed, a = new phase */
+    TRACE_AMB_STANDBY,      /* a = steps until dispatch */
+    TRACE_AMB_DISPATCHED,
+    TRACE_AMB_URGENT,       /* a = steps left */
+    TRACE_AMB_ON_TIME,
+    TRACE_AMB_LATE,
+    TRACE_AMB_GAVE_UP,      /* Missed golden time on the way */
+    TRACE_AMB_PREEMPT,      /* Light forced to phase a for an ambulance */
+};
+
+/* Longest vehicle name kept in a record, longer ones are cut */
+#define TRACE_NAME_LEN 7
+
+/* One event. The vehicle name is copied, since finished vehicles are
+   freed long before the ring is dumped. */
+struct trace_record {
+    int step;
+    char name[TRACE_NAME_LEN + 1]; /* Vehicle, empty for system events */
+    unsigned char type;     /* enum trace_type */
+    signed char a, b;       /* Event arguments */
+};
+
+/* Records an event of LEVEL. Compiles to nothing above
+   TRACE_LEVEL_MAX and costs one compare when filtered at run time. */
+#define TRACE(LEVEL, TYPE, VI, A, B)                                    \
+    do {                                                                \
+        if ((LEVEL) <= TRACE_LEVEL_MAX &&                               \
+            (LEVEL) <= crossroads_options.trace_level) {                \
+            trace_record((TYPE), (VI), (A), (B));                       \
+        }                                                               \
+    } while (0)
+
+void trace_init(void);
+void trace_record(enum trace_type type, const struct vehicle_info *vi,
+    int a, int b);
+void trace_dump(void);
+
+#endif /* __PROJECTS_CROSSROADS_TRACE_H__ */
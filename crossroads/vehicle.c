@@ -1,128 +1,60 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <limits.h>
+#include <stdint.h>
 
 #include "threads/thread.h"
 #include "threads/synch.h"
 #include "threads/malloc.h"
 #include "threads/interrupt.h"
+#include "projects/crossroads/crossroads.h"
 #include "projects/crossroads/vehicle.h"
 #include "projects/crossroads/map.h"
 #include "projects/crossroads/ats.h"
 #include "projects/crossroads/priority_sync.h"
 #include "projects/crossroads/deadlock_prevention.h"
 #include "projects/crossroads/blinker.h"
-
-static struct lock step_sync_lock;
-static struct condition step_sync_cond;
-static int vehicles_completed_step = 0;
-static int total_active_vehicles = 0;
+#include "projects/crossroads/step_barrier.h"
+#include "projects/crossroads/stats.h"
+#include "projects/crossroads/trace.h"
+#include "projects/crossroads/occupancy.h"
+#include "projects/crossroads/wait_graph.h"
+#include "projects/crossroads/watchdog.h"
+#include "projects/crossroads/scenario.h"
+#include "projects/crossroads/step_timing.h"
+
+struct list active_vehicles;
+
+/* Vehicle slots. A finished vehicle's slot is kept for the next
+   arrival, together with its thread if it has one, so the slots
+   allocated never exceed the most vehicles on the road at once. */
+static struct list free_slots;
+static int slots_in_use;
+static int slot_cnt;
+
+static struct step_barrier step_barrier;
 static bool step_sync_initialized = false;
-static int total_vehicle_count = 0;
-
-/* path. A:0 B:1 C:2 D:3 */
-const struct position vehicle_path[4][4][12] = {
-    /* from A */ {
-        /* to A */
-        {{4,0},{4,1},{4,2},{4,3},{4,4},{3,4},{2,4},{2,3},{2,2},{2,1},{2,0},{-1,-1},},
-        /* to B */
-        {{4,0},{4,1},{4,2},{5,2},{6,2},{-1,-1},},
-        /* to C */
-        {{4,0},{4,1},{4,2},{4,3},{4,4},{4,5},{4,6},{-1,-1},},
-        /* to D */
-        {{4,0},{4,1},{4,2},{4,3},{4,4},{3,4},{2,4},{1,4},{0,4},{-1,-1},}
-    },
-    /* from B */ {
-        /* to A */
-        {{6,4},{5,4},{4,4},{3,4},{2,4},{2,3},{2,2},{2,1},{2,0},{-1,-1},},
-        /* to B */
-        {{6,4},{5,4},{4,4},{3,4},{2,4},{2,3},{2,2},{3,2},{4,2},{5,2},{6,2},{-1,-1},},
-        /* to C */
-        {{6,4},{5,4},{4,4},{4,5},{4,6},{-1,-1},},
-        /* to D */
-        {{6,4},{5,4},{4,4},{3,4},{2,4},{1,4},{0,4},{-1,-1},}
-    },
-    /* from C */ {
-        /* to A */
-        {{2,6},{2,5},{2,4},{2,3},{2,2},{2,1},{2,0},{-1,-1},},
-        /* to B */
-        {{2,6},{2,5},{2,4},{2,3},{2,2},{3,2},{4,2},{5,2},{6,2},{-1,-1},},
-        /* to C */
-        {{2,6},{2,5},{2,4},{2,3},{2,2},{3,2},{4,2},{4,3},{4,4},{4,5},{4,6},{-1,-1},},
-        /* to D */
-        {{2,6},{2,5},{2,4},{1,4},{0,4},{-1,-1},}
-    },
-    /* from D */ {
-        /* to A */
-        {{0,2},{1,2},{2,2},{2,1},{2,0},{-1,-1},},
-        /* to B */
-        {{0,2},{1,2},{2,2},{3,2},{4,2},{5,2},{6,2},{-1,-1},},
-        /* to C */
-        {{0,2},{1,2},{2,2},{3,2},{4,2},{4,3},{4,4},{4,5},{4,6},{-1,-1},},
-        /* to D */
-        {{0,2},{1,2},{2,2},{3,2},{4,2},{4,3},{4,4},{3,4},{2,4},{1,4},{0,4},{-1,-1},}
-    }
-};
-
-void parse_vehicles(struct vehicle_info* vehicle_info, char* input)
+static int next_vehicle_id;
+static bool run_finished;
+static struct semaphore vehicles_finished_sema;
+
+static void plan_moves(void);
+static void reap_vehicles(void);
+static void release_arrivals(void);
+
+/* Steps an ambulance can still lose and arrive in time: its golden
+   time, less the current step and the moves left on its path. The
+   last of those moves takes it off the map, which must happen no
+   later than the golden time. Normal vehicles have no deadline. */
+int vehicle_slack(const struct vehicle_info* vi)
 {
-    char* token;
-    char* input_copy;
-    char* saveptr;
-    int vehicle_count = 0;
-
-    /* Make a copy of input string */
-    input_copy = malloc(strlen(input) + 1);
-    strlcpy(input_copy, input, strlen(input) + 1);
-
-    /* Parse each vehicle using strtok_r */
-    token = strtok_r(input_copy, ":", &saveptr);
-
-    while (token != NULL && vehicle_count < 16) {
-        struct vehicle_info* vi = &vehicle_info[vehicle_count];
-
-        /* Basic vehicle info */
-        vi->id = token[0];
-        vi->start = token[1];
-        vi->dest = token[2];
-
-        /* Initialize state */
-        vi->state = VEHICLE_STATUS_READY;
-        vi->position.row = -1;
-        vi->position.col = -1;
-
-        /* Default to normal vehicle */
-        vi->type = VEHICL_TYPE_NORMAL;
-        vi->arrival = 0;
-        vi->golden_time = -1;
-
-        /* Check if ambulance (has timing info) */
-        if (strlen(token) > 3) {
-            char* dot_pos = strchr(token + 3, '.');
-            if (dot_pos != NULL) {
-                /* Parse ambulance timing */
-                vi->type = VEHICL_TYPE_AMBULANCE;
-                vi->arrival = atoi(token + 3);
-                vi->golden_time = atoi(dot_pos + 1);
-
-                printf("Ambulance %c: %c->%c, arrival=%d, golden_time=%d\n",
-                    vi->id, vi->start, vi->dest, vi->arrival, vi->golden_time);
-            }
-        }
-        else {
-            printf("Normal vehicle %c: %c->%c\n", vi->id, vi->start, vi->dest);
-        }
+    int remaining = route_info[vi->start - 'A'][vi->dest - 'A'].length - vi->path_step;
 
-        vehicle_count++;
-        token = strtok_r(NULL, ":", &saveptr);
+    if (vi->type != VEHICL_TYPE_AMBULANCE) {
+        return INT_MAX;
     }
-
-    free(input_copy);
-
-    /* Update global counters */
-    total_active_vehicles = vehicle_count;
-    total_vehicle_count = vehicle_count;
-    printf("Total vehicles parsed: %d\n", vehicle_count);
+    return vi->golden_time - crossroads_step - remaining;
 }
 
 static int is_position_outside(struct position pos)
@@ -133,8 +65,8 @@ static int is_position_outside(struct position pos)
 /* Check if vehicle needs traffic light permission */
 static bool needs_traffic_light_check(struct position current, struct position next) {
     /* Only check when entering intersection from outside */
-    bool current_in_intersection = (current.row >= 2 && current.row <= 4 && current.col >= 2 && current.col <= 4);
-    bool next_in_intersection = (next.row >= 2 && next.row <= 4 && next.col >= 2 && next.col <= 4);
+    bool current_in_intersection = is_intersection_position(current);
+    bool next_in_intersection = is_intersection_position(next);
 
     /* Need to check if moving into intersection from outside */
     return (!current_in_intersection && next_in_intersection);
@@ -146,6 +78,8 @@ static int try_move(int start, int dest, int step, struct vehicle_info* vi)
     struct position pos_cur, pos_next;
     bool was_in_intersection = false;
     bool will_be_in_intersection = false;
+    bool acquired, admitted, proceed;
+    int64_t timing_start;
 
     pos_next = vehicle_path[start][dest][step];
     pos_cur = vi->position;
@@ -162,10 +96,8 @@ static int try_move(int start, int dest, int step, struct vehicle_info* vi)
             }
 
             if (!is_position_outside(pos_cur)) {
-                /* Release map lock */
-                if (vi->map_locks[pos_cur.row][pos_cur.col].holder == thread_current()) {
-                    lock_release(&vi->map_locks[pos_cur.row][pos_cur.col]);
-                }
+                /* Release its cell */
+                release_cell(vi, pos_cur);
             }
             vi->position.row = vi->position.col = -1;
             return 0;
@@ -175,41 +107,62 @@ static int try_move(int start, int dest, int step, struct vehicle_info* vi)
     /* Check traffic light if needed */
     if (vi->state == VEHICLE_STATUS_RUNNING &&
         needs_traffic_light_check(pos_cur, pos_next)) {
-        if (!can_vehicle_proceed(pos_cur, pos_next)) {
-            printf("VEHICLE %c waiting: red light at (%d,%d) -> (%d,%d) step %d\n",
-                vi->id, pos_cur.row, pos_cur.col, pos_next.row, pos_next.col, crossroads_step);
+        timing_start = TIMING_NOW();
+        proceed = can_vehicle_proceed(pos_cur, pos_next);
+        TIMING_RECORD(TIMING_SIGNAL_CHECK, timing_start);
+        if (!proceed) {
+            TRACE(TRACE_MOVES, TRACE_RED_LIGHT, vi, pos_cur.row, pos_cur.col);
+            vi->red_wait_steps++;
             return -1;  /* Wait for green light */
         }
     }
 
+    /* Keep out of an ambulance's way. Vehicles in the center hold
+       reservations for their whole run and are not held back there. */
+    if (!is_intersection_position(pos_cur) && is_held_by_wave(vi, pos_cur, pos_next)) {
+        TRACE(TRACE_MOVES, TRACE_WAVE_HOLD, vi, pos_next.row, pos_next.col);
+        return -1;
+    }
+
     will_be_in_intersection = is_intersection_position(pos_next);
 
     /* Check intersection entry restrictions */
     if (will_be_in_intersection && vi->state == VEHICLE_STATUS_RUNNING) {
         if (!is_intersection_position(pos_cur)) {
             /* Entering intersection from outside */
-            if (!can_enter_intersection(vi, pos_next)) {
+            timing_start = TIMING_NOW();
+            admitted = can_enter_intersection(vi, pos_next);
+            TIMING_RECORD(TIMING_ADMISSION, timing_start);
+            if (!admitted) {
                 return -1;
             }
         }
     }
 
-    /* Try to acquire map lock for next position */
-    if (vi->type == VEHICL_TYPE_AMBULANCE && (vi->golden_time - crossroads_step) <= 2) {
-        /* Emergency ambulance - blocking acquire */
-        lock_acquire(&vi->map_locks[pos_next.row][pos_next.col]);
+    /* Try to claim the next cell */
+    timing_start = TIMING_NOW();
+    if (vi->type == VEHICL_TYPE_AMBULANCE && vehicle_slack(vi) <= 2 &&
+        !crossroads_options.planner) {
+        /* Emergency ambulance - waits for the cell while that is safe */
+        acquired = acquire_cell_waiting(vi, pos_next);
     }
     else {
-        /* Try non-blocking acquire */
-        if (!lock_try_acquire(&vi->map_locks[pos_next.row][pos_next.col])) {
-            /* Failed to get position lock */
-            if (will_be_in_intersection && !is_intersection_position(pos_cur)) {
-                /* Release intersection capacity if we just acquired it */
-                int zones[] = { ZONE_CENTER };
-                release_zones(vi, zones, 1);
-            }
-            return -1;
+        /* Try non-blocking claim */
+        acquired = claim_cell(vi, pos_next);
+    }
+    TIMING_RECORD(TIMING_CELL_CLAIM, timing_start);
+    if (!acquired) {
+        /* Next cell is taken */
+        if (will_be_in_intersection && !is_intersection_position(pos_cur)) {
+            /* Give back the reservation we just made */
+            int zones[] = { ZONE_CENTER };
+            release_zones(vi, zones, 1);
+        }
+        else if (is_intersection_position(pos_cur)) {
+            /* Late inside the center, keep the rest of the run */
+            hold_center_run(vi);
         }
+        return -1;
     }
 
     /* Successfully acquired new position, release old position */
@@ -217,49 +170,53 @@ static int try_move(int start, int dest, int step, struct vehicle_info* vi)
         vi->state = VEHICLE_STATUS_RUNNING;
     }
     else if (!is_position_outside(pos_cur)) {
-        was_in_intersection = is_intersection_position(pos_cur);
+        /* Center reservations expire on their own. The exit cell is
+           still reserved for this step and the next, so nothing is
+           given back when leaving the center. */
 
-        /* Release old intersection capacity if leaving intersection */
-        if (was_in_intersection && !will_be_in_intersection) {
-            int zones[] = { ZONE_CENTER };
-            release_zones(vi, zones, 1);
-        }
-
-        /* Release map lock for old position */
-        if (vi->map_locks[pos_cur.row][pos_cur.col].holder == thread_current()) {
-            lock_release(&vi->map_locks[pos_cur.row][pos_cur.col]);
-        }
+        /* Release the old cell */
+        release_cell(vi, pos_cur);
     }
 
     vi->position = pos_next;
+    TRACE(TRACE_MOVES, TRACE_MOVE, vi, pos_next.row, pos_next.col);
     return 1;
 }
 
-static void wait_for_step_completion(void)
+/* Step barrier action: advances the unit step and runs the per-step
+   hooks. Runs in the vehicle that completed the step, before anyone
+   is released. Vehicles done by now are counted out, and the ones
+   arriving at the new step are let in. In fast mode the unit-step
+   sleep is skipped, so the next step starts as soon as every vehicle
+   is through. */
+static void step_changed(void* aux UNUSED)
 {
-    lock_acquire(&step_sync_lock);
+    int64_t timing_start = TIMING_NOW();
 
-    vehicles_completed_step++;
+    reap_vehicles();
+    if (crossroads_options.planner) {
+        plan_moves();
+    }
+    sample_step_stats();
+    watchdog_step();
+    crossroads_step++;
+    release_arrivals();
+    blinker_step_changed();
 
-    if (vehicles_completed_step >= total_active_vehicles) {
-        /* All active vehicles completed their step */
-        crossroads_step++;
-        vehicles_completed_step = 0;
+    TIMING_RECORD(TIMING_STEP_ACTION, timing_start);
 
-        /* Call unitstep_changed() with thread safety */
-        lock_release(&step_sync_lock);
+    if (!crossroads_options.fast) {
         unitstep_changed();
-        lock_acquire(&step_sync_lock);
-
-        /* Wake up all waiting vehicles */
-        cond_broadcast(&step_sync_cond, &step_sync_lock);
-    }
-    else {
-        /* Wait for other vehicles */
-        cond_wait(&step_sync_cond, &step_sync_lock);
     }
+}
+
+static void wait_for_step_completion(struct vehicle_info* vi, bool* step_sense)
+{
+    int64_t timing_start = TIMING_NOW();
 
-    lock_release(&step_sync_lock);
+    vi->parked_step = crossroads_step;
+    step_barrier_wait(&step_barrier, step_sense);
+    TIMING_RECORD(TIMING_BARRIER_WAIT, timing_start);
 }
 
 static bool should_start_vehicle(struct vehicle_info* vi)
@@ -281,12 +238,25 @@ static void handle_ambulance_waiting(struct vehicle_info* vi)
     if (vi->type == VEHICL_TYPE_AMBULANCE && crossroads_step < vi->arrival) {
         int wait_time = vi->arrival - crossroads_step;
         if (wait_time <= 3) {
-            printf("AMBULANCE %c STANDBY - %d steps until dispatch\n",
-                vi->id, wait_time);
+            TRACE(TRACE_EVENTS, TRACE_AMB_STANDBY, vi, wait_time, 0);
         }
     }
 }
 
+/* Takes a vehicle that gives up off the map, releasing its cell and
+   any center reservations it still holds */
+static void abandon_position(struct vehicle_info* vi)
+{
+    struct position pos = vi->position;
+    int zones[] = { ZONE_CENTER };
+
+    release_zones(vi, zones, 1);
+    if (vi->state == VEHICLE_STATUS_RUNNING && !is_position_outside(pos)) {
+        release_cell(vi, pos);
+    }
+    vi->position.row = vi->position.col = -1;
+}
+
 static bool check_golden_time(struct vehicle_info* vi)
 {
     if (vi->type == VEHICL_TYPE_NORMAL) {
@@ -294,125 +264,511 @@ static bool check_golden_time(struct vehicle_info* vi)
     }
 
     if (crossroads_step > vi->golden_time) {
-        printf("AMBULANCE %c FAILED - Missed golden time!\n", vi->id);
+        TRACE(TRACE_EVENTS, TRACE_AMB_GAVE_UP, vi, 0, 0);
         return false;
     }
 
     return true;
 }
 
-void init_on_mainthread(int thread_cnt)
+/* Sets up the step barrier with the main thread as its only party,
+   until start_vehicles() hands the steps over to the vehicles. */
+void init_on_mainthread(void)
 {
     if (!step_sync_initialized) {
-        lock_init(&step_sync_lock);
-        cond_init(&step_sync_cond);
-        vehicles_completed_step = 0;
-        total_active_vehicles = thread_cnt;
-        total_vehicle_count = thread_cnt;
+        list_init(&active_vehicles);
+        list_init(&free_slots);
+        slots_in_use = 0;
+        slot_cnt = 0;
+        step_barrier_init(&step_barrier, 1, step_changed, NULL);
+        sema_init(&vehicles_finished_sema, 0);
+        next_vehicle_id = 0;
+        run_finished = false;
         step_sync_initialized = true;
 
         /* Initialize deadlock prevention systems */
         init_deadlock_prevention();
         init_intersection_safety();
+        init_occupancy();
 
-        printf("Step synchronization initialized for %d vehicles\n", thread_cnt);
+        printf("Step synchronization initialized\n");
     }
 }
 
-void vehicle_loop(void* _vi)
+/* Blocks the caller until every vehicle thread has finished. */
+void wait_for_vehicles_finished(void)
 {
-    int res;
-    int start, dest, step;
-    struct vehicle_info* vi = _vi;
+    sema_down(&vehicles_finished_sema);
+}
 
-    start = vi->start - 'A';
-    dest = vi->dest - 'A';
+/* True once the last vehicle has left and no more are to come */
+bool vehicles_finished(void)
+{
+    return run_finished;
+}
+
+/* Leaves the step barrier for good, completing the step if everyone
+   else is already waiting on it. If that leaves nobody on the road
+   while more vehicles are to come, the caller keeps the steps going
+   on its own until one of them has arrived. */
+static void leave_step_barrier(void)
+{
+    bool step_sense;
+
+    while (step_barrier_leave(&step_barrier) == 0) {
+        if (scenario_done()) {
+            run_finished = true;
+            sema_up(&vehicles_finished_sema);
+            return;
+        }
+        step_barrier_join(&step_barrier, 1);
+        step_barrier_enter(&step_barrier, &step_sense);
+        step_barrier_wait(&step_barrier, &step_sense);
+    }
+}
 
+/* Puts VI at the start of its path, off the map */
+static void start_vehicle(struct vehicle_info* vi)
+{
     vi->position.row = vi->position.col = -1;
     vi->state = VEHICLE_STATUS_READY;
 
-    step = 0;
+    vi->path_step = 0;
+    vi->blocked_steps = 0;
+    vi->red_wait_steps = 0;
+    vi->finish_step = -1;
+    vi->waiting_for.row = vi->waiting_for.col = -1;
+    vi->parked_step = -1;
+    vi->planned_step = -1;
 
-    printf("Vehicle %c thread started: %c->%c (type: %s)\n",
-        vi->id, vi->start, vi->dest,
-        vi->type == VEHICL_TYPE_AMBULANCE ? "AMBULANCE" : "NORMAL");
+    TRACE(TRACE_MOVES, TRACE_STARTED, vi, 0, 0);
+}
 
-    while (1) {
-        /* Check if vehicle should start */
-        if (!should_start_vehicle(vi)) {
-            handle_ambulance_waiting(vi);
-            wait_for_step_completion();
-            continue;
+/* True if another vehicle may be let in */
+static bool has_free_slot(void)
+{
+    return crossroads_options.slots == 0 || slots_in_use < crossroads_options.slots;
+}
+
+/* Starts the thread of the new slot VI, counted in as a party of the
+   step barrier. It drives whatever vehicle the slot is given until
+   the run is over. */
+static bool start_slot_thread(struct vehicle_info* vi)
+{
+    char name[16];
+
+    snprintf(name, sizeof name, "vehicle %d", vi->slot);
+    step_barrier_join(&step_barrier, 1);
+    if (thread_create(name, PRI_DEFAULT, vehicle_loop, vi) == TID_ERROR) {
+        step_barrier_join(&step_barrier, -1);
+        return false;
+    }
+    return true;
+}
+
+/* Lets in the vehicles arriving at the current step, as long as there
+   are slots for them; the others wait in the scenario, keeping their
+   arrival step. Runs in the step barrier action, or on the main thread
+   before the first step, so no vehicle is walking the lists meanwhile.
+   A free slot's thread is idle at the barrier and picks up its new
+   vehicle once released. Nobody is let in after a watchdog abort. */
+static void release_arrivals(void)
+{
+    struct vehicle_info next;
+    struct vehicle_info* vi;
+    enum intr_level old_level;
+    bool is_new;
+
+    while (!watchdog_aborted() && has_free_slot() && scenario_next(&next)) {
+        is_new = list_empty(&free_slots);
+        if (is_new) {
+            vi = malloc(sizeof *vi);
+            if (vi == NULL) {
+                PANIC("cannot allocate vehicle slot %d", slot_cnt);
+            }
+            next.slot = slot_cnt++;
+        }
+        else {
+            vi = list_entry(list_pop_front(&free_slots), struct vehicle_info, elem);
+            next.slot = vi->slot;
         }
 
-        /* Announce ambulance dispatch */
-        if (vi->state == VEHICLE_STATUS_READY && step == 0 &&
-            vi->type == VEHICL_TYPE_AMBULANCE) {
-            printf("AMBULANCE %c DISPATCHED at step %d\n",
-                vi->id, crossroads_step);
+        *vi = next;
+        if (next.name == next.name_buf) {
+            vi->name = vi->name_buf;
         }
+        vi->id = next_vehicle_id++;
+        start_vehicle(vi);
+
+        old_level = intr_disable();
+        list_push_back(&active_vehicles, &vi->elem);
+        intr_set_level(old_level);
+        slots_in_use++;
+
+        if (is_new && crossroads_options.workers == 0 && !start_slot_thread(vi)) {
+            /* A slot without a thread cannot be handed on */
+            printf("cannot start vehicle %s, dropping it\n", vi->name);
+            old_level = intr_disable();
+            list_remove(&vi->elem);
+            intr_set_level(old_level);
+            record_vehicle_done(vi);
+            free(vi);
+            slots_in_use--;
+            slot_cnt--;
+        }
+    }
+}
 
-        /* Check golden time */
-        if (!check_golden_time(vi)) {
-            break;
+/* Counts out the vehicles that are done and keeps their slots for the
+   next arrivals. Runs in the step barrier action, while the threads
+   of those slots are idle at the barrier or gone. */
+static void reap_vehicles(void)
+{
+    struct list_elem* e = list_begin(&active_vehicles);
+
+    while (e != list_end(&active_vehicles)) {
+        struct vehicle_info* vi = list_entry(e, struct vehicle_info, elem);
+        enum intr_level old_level;
+
+        if (vi->state != VEHICLE_STATUS_FINISHED) {
+            e = list_next(e);
+            continue;
         }
 
-        /* Try to move */
-        res = try_move(start, dest, step, vi);
-
-        if (res == 1) {
-            /* Successfully moved */
-            step++;
-            if (vi->type == VEHICL_TYPE_AMBULANCE) {
-                int time_left = vi->golden_time - crossroads_step;
-                if (time_left <= 3) {
-                    printf("AMBULANCE %c URGENT - %d steps left!\n",
-                        vi->id, time_left);
-                }
+        old_level = intr_disable();
+        e = list_remove(e);
+        intr_set_level(old_level);
+
+        drop_entry_request(vi);
+        record_vehicle_done(vi);
+        list_push_back(&free_slots, &vi->elem);
+        slots_in_use--;
+    }
+}
+
+/* Counts out whatever is left once the run is over and frees every
+   slot. The slot threads have all left by then. */
+void release_vehicles(void)
+{
+    reap_vehicles();
+    while (!list_empty(&active_vehicles)) {
+        struct vehicle_info* vi = list_entry(list_pop_front(&active_vehicles),
+            struct vehicle_info, elem);
+
+        drop_entry_request(vi);
+        record_vehicle_done(vi);
+        free(vi);
+    }
+    printf("released %d vehicle slots\n", slot_cnt);
+    while (!list_empty(&free_slots)) {
+        free(list_entry(list_pop_front(&free_slots), struct vehicle_info, elem));
+    }
+}
+
+/* Moves VI one cell along its path if it can. Returns true once it
+   has left the map. */
+static bool move_vehicle(struct vehicle_info* vi)
+{
+    int res;
+    int start = vi->start - 'A';
+    int dest = vi->dest - 'A';
+
+    /* Clear the road ahead of an ambulance */
+    if (vi->type == VEHICL_TYPE_AMBULANCE) {
+        preempt_normal_vehicles(vi);
+    }
+
+    /* Try to move */
+    res = try_move(start, dest, vi->path_step, vi);
+
+    if (res != -1) {
+        watchdog_note_move();
+    }
+
+    if (res == 1) {
+        /* Successfully moved */
+        vi->path_step++;
+        if (vi->type == VEHICL_TYPE_AMBULANCE) {
+            int time_left = vi->golden_time - crossroads_step;
+            if (time_left <= 3) {
+                TRACE(TRACE_EVENTS, TRACE_AMB_URGENT, vi, time_left, 0);
             }
         }
+    }
 
-        /* Check termination */
-        if (res == 0) {
-            if (vi->type == VEHICL_TYPE_AMBULANCE) {
-                if (crossroads_step <= vi->golden_time) {
-                    printf("AMBULANCE %c SUCCESS - Arrived in time!\n", vi->id);
-                }
-                else {
-                    printf("AMBULANCE %c FAILED - Arrived too late!\n", vi->id);
-                }
+    /* Check termination */
+    if (res == 0) {
+        vi->finish_step = crossroads_step;
+        if (vi->type == VEHICL_TYPE_AMBULANCE) {
+            if (crossroads_step <= vi->golden_time) {
+                TRACE(TRACE_EVENTS, TRACE_AMB_ON_TIME, vi, 0, 0);
             }
             else {
-                printf("Vehicle %c arrived at destination\n", vi->id);
+                TRACE(TRACE_EVENTS, TRACE_AMB_LATE, vi, 0, 0);
             }
-            break;
+        }
+        else {
+            TRACE(TRACE_MOVES, TRACE_ARRIVED, vi, 0, 0);
+        }
+        return true;
+    }
+
+    if (res == -1) {
+        vi->blocked_steps++;
+        TRACE(TRACE_MOVES, TRACE_BLOCKED, vi, vi->path_step, 0);
+    }
+
+    return false;
+}
+
+/* Runs one unit step of VI. Returns true once VI is done: arrived,
+   gave up, or the run was aborted. The caller then marks it
+   finished. */
+static bool vehicle_step(struct vehicle_info* vi)
+{
+    /* The move planner took it off the map last step */
+    if (vi->finish_step >= 0) {
+        return true;
+    }
+
+    /* The watchdog gave up on the run, leave the map */
+    if (watchdog_aborted()) {
+        abandon_position(vi);
+        return true;
+    }
+
+    /* Check if vehicle should start */
+    if (!should_start_vehicle(vi)) {
+        handle_ambulance_waiting(vi);
+        return false;
+    }
+
+    /* Announce ambulance dispatch, once */
+    if (vi->type == VEHICL_TYPE_AMBULANCE && crossroads_step == vi->arrival) {
+        TRACE(TRACE_EVENTS, TRACE_AMB_DISPATCHED, vi, 0, 0);
+    }
+
+    /* Check golden time */
+    if (!check_golden_time(vi)) {
+        abandon_position(vi);
+        return true;
+    }
+
+    /* The move planner moves it at the end of the step */
+    if (crossroads_options.planner) {
+        return false;
+    }
+
+    return move_vehicle(vi);
+}
+
+/* vehicle_step(), timed */
+static bool timed_vehicle_step(struct vehicle_info* vi)
+{
+    int64_t timing_start = TIMING_NOW();
+    bool done = vehicle_step(vi);
+
+    TIMING_RECORD(TIMING_VEHICLE_STEP, timing_start);
+    return done;
+}
+
+/* Move planner. With -planner the vehicles do not take cells
+   themselves. Once every vehicle has reached the step barrier, the
+   barrier action moves them all in one pass: the most urgent first,
+   then the ones furthest along their path, then in arrival order.
+   The outcome depends on the input alone, never on which thread the
+   scheduler happened to run first. */
+static bool is_waiting_to_move(struct vehicle_info* vi)
+{
+    return vi->state != VEHICLE_STATUS_FINISHED && vi->finish_step < 0 &&
+        should_start_vehicle(vi);
+}
+
+/* True if the planner takes A up before B: higher priority, then the
+   ambulance with less slack, then the one further along, then the
+   one that arrived first */
+static bool plans_before(const struct list_elem* a_, const struct list_elem* b_,
+    void* aux UNUSED)
+{
+    struct vehicle_info* a = list_entry(a_, struct vehicle_info, elem);
+    struct vehicle_info* b = list_entry(b_, struct vehicle_info, elem);
+    int pa = get_vehicle_priority(a);
+    int pb = get_vehicle_priority(b);
+
+    if (pa != pb) {
+        return pa > pb;
+    }
+    if (vehicle_slack(a) != vehicle_slack(b)) {
+        return vehicle_slack(a) < vehicle_slack(b);
+    }
+    if (a->path_step != b->path_step) {
+        return a->path_step > b->path_step;
+    }
+    return a->id < b->id;
+}
+
+/* Moves VI, after the vehicles ahead of it on the cells it wants,
+   so that a queue moves up as a whole. The chain ends at a free cell
+   or at a vehicle already taken up this step, which also cuts a
+   circular wait short: its members keep their cells. */
+static void plan_vehicle(struct vehicle_info* vi)
+{
+    struct vehicle_info* chain[MAP_MAX_SIZE * MAP_MAX_SIZE];
+    int len = 0;
+
+    while (vi != NULL && len < MAP_MAX_SIZE * MAP_MAX_SIZE && vi->planned_step != crossroads_step &&
+        is_waiting_to_move(vi)) {
+        struct position next = vehicle_path[vi->start - 'A'][vi->dest - 'A'][vi->path_step];
+
+        vi->planned_step = crossroads_step;
+        chain[len++] = vi;
+        vi = is_position_outside(next) ? NULL : cell_owner_at(next);
+    }
+
+    while (len > 0) {
+        move_vehicle(chain[--len]);
+    }
+}
+
+/* Step barrier action part of the planner, with every vehicle parked */
+static void plan_moves(void)
+{
+    struct list_elem* e;
+    enum intr_level old_level;
+
+    if (watchdog_aborted()) {
+        return;
+    }
+
+    /* The list is kept in planner order from step to step */
+    old_level = intr_disable();
+    list_sort(&active_vehicles, plans_before, NULL);
+    intr_set_level(old_level);
+
+    for (e = list_begin(&active_vehicles); e != list_end(&active_vehicles); e = list_next(e)) {
+        plan_vehicle(list_entry(e, struct vehicle_info, elem));
+    }
+}
+
+/* Thread per vehicle slot. Once its vehicle is done, the thread
+   stays at the step barrier until the slot is handed the next
+   arrival, and leaves when no more vehicles are to come. */
+void vehicle_loop(void* _vi)
+{
+    bool step_sense;
+    struct vehicle_info* vi = _vi;
+
+    step_barrier_enter(&step_barrier, &step_sense);
+
+    while (true) {
+        while (!timed_vehicle_step(vi)) {
+            /* Wait for next step */
+            wait_for_step_completion(vi, &step_sense);
         }
 
-        if (res == -1) {
-            printf("Vehicle %c blocked at step %d\n", vi->id, step);
+        /* Mark as finished */
+        vi->state = VEHICLE_STATUS_FINISHED;
+
+        /* Idle until the slot is given a new vehicle */
+        while (vi->state == VEHICLE_STATUS_FINISHED) {
+            if (scenario_done()) {
+                leave_step_barrier();
+                return;
+            }
+            step_barrier_wait(&step_barrier, &step_sense);
         }
+    }
+}
+
+/* Worker pool: worker I drives the vehicles whose id is I modulo
+   the pool size, one step of each in list order, and then waits at
+   the step barrier like a vehicle thread would. The assignment never
+   changes, so the wait-for graph can tell which vehicles a waiting
+   worker is holding up. A worker stays until it has nothing left to
+   drive and no more vehicles are to come. */
+static int worker_cnt;
 
-        /* Wait for next step */
-        wait_for_step_completion();
+/* True if A and B are moved by the same thread */
+bool is_same_driver(const struct vehicle_info* a, const struct vehicle_info* b)
+{
+    if (worker_cnt == 0) {
+        return a == b;
     }
+    return a->id % worker_cnt == b->id % worker_cnt;
+}
 
-    /* Mark as finished */
-    vi->state = VEHICLE_STATUS_FINISHED;
+static void worker_loop(void* aux)
+{
+    int index = (int) (intptr_t) aux;
+    int remaining;
+    bool step_sense;
+    int64_t timing_start;
+
+    step_barrier_enter(&step_barrier, &step_sense);
+
+    while (true) {
+        struct list_elem* e;
+
+        remaining = 0;
+        for (e = list_begin(&active_vehicles); e != list_end(&active_vehicles);
+            e = list_next(e)) {
+            struct vehicle_info* vi = list_entry(e, struct vehicle_info, elem);
+
+            /* Skip other workers' vehicles, and its own that are done
+               or were driven this step before the pool shrank */
+            if (vi->id % worker_cnt != index || vi->state == VEHICLE_STATUS_FINISHED ||
+                vi->parked_step == crossroads_step) {
+                continue;
+            }
+            if (timed_vehicle_step(vi)) {
+                vi->state = VEHICLE_STATUS_FINISHED;
+            }
+            else {
+                vi->parked_step = crossroads_step;
+                remaining++;
+            }
+        }
+        if (remaining == 0 && scenario_done()) {
+            break;
+        }
+        timing_start = TIMING_NOW();
+        step_barrier_wait(&step_barrier, &step_sense);
+        TIMING_RECORD(TIMING_BARRIER_WAIT, timing_start);
+    }
 
-    /* Decrement active vehicles */
-    lock_acquire(&step_sync_lock);
-    total_active_vehicles--;
+    leave_step_barrier();
+}
 
-    /* Check if we need to advance step */
-    if (vehicles_completed_step >= total_active_vehicles && total_active_vehicles > 0) {
-        crossroads_step++;
-        vehicles_completed_step = 0;
-        lock_release(&step_sync_lock);
-        unitstep_changed();
-        lock_acquire(&step_sync_lock);
-        cond_broadcast(&step_sync_cond, &step_sync_lock);
+/* Hands the steps over from the main thread to the vehicles: lets in
+   the vehicles arriving at step 0, starts the worker pool if there is
+   one, and leaves the step barrier. */
+void start_vehicles(void)
+{
+    int workers = crossroads_options.workers;
+
+    release_arrivals();
+
+    if (workers > 0) {
+        printf("initializing %d vehicle workers...\n", workers);
+        worker_cnt = workers;
+        for (int w = 0; w < workers; w++) {
+            char name[20];
+
+            snprintf(name, sizeof name, "worker %d", w);
+            step_barrier_join(&step_barrier, 1);
+            if (thread_create(name, PRI_DEFAULT, worker_loop, (void*) (intptr_t) w) == TID_ERROR) {
+                step_barrier_join(&step_barrier, -1);
+                if (w == 0) {
+                    PANIC("cannot start any vehicle worker");
+                }
+                /* The vehicles are handed out again over the ones
+                   that did start */
+                printf("cannot start %s, running with %d workers\n", name, w);
+                worker_cnt = w;
+                break;
+            }
+        }
     }
-    lock_release(&step_sync_lock);
 
-    printf("Vehicle %c thread finished\n", vi->id);
-}
\ No newline at end of file
+    leave_step_barrier();
+}
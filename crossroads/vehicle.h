@@ -2,7 +2,9 @@
 #define __PROJECTS_PROJECT2_VEHICLE_H__
 
 #include "projects/crossroads/position.h"
+#include "projects/crossroads/layout.h"
 #include "threads/synch.h"
+#include "lib/kernel/list.h"
 
 /* Vehicle status definitions */
 #define VEHICLE_STATUS_READY 	0
@@ -13,27 +15,51 @@
 #define VEHICL_TYPE_NORMAL 0
 #define VEHICL_TYPE_AMBULANCE 1
 
-/* Vehicle information structure */
+/* Vehicle information structure. A slot is taken when the vehicle
+   arrives and handed to the next arrival once it is done and counted.
+   The small fields are packed together and the time fields are wide
+   enough for long traces. */
 struct vehicle_info {
-	char id;                    
+	int id;                     /* Arrival order, never reused */
+	int slot;                   /* Slot it was given, see vehicle.c */
+	int arrival;                /* Dispatch step (ambulance) */
+	int golden_time;            /* Deadline step (ambulance) */
+	int path_step;              /* Index of its next cell in vehicle_path */
+
+	/* Run statistics */
+	int blocked_steps;          /* Steps try_move() failed */
+	int red_wait_steps;         /* Of those, steps held by a red light */
+	int finish_step;            /* Step it left the map, -1 if never ran */
+
+	/* Wait-for graph, see wait_graph.h */
+	struct position waiting_for; /* Cell it is waiting for, row -1 if none */
+	int parked_step;            /* Last step it reached the step barrier */
+	int planned_step;           /* Last step the move planner took it up */
+
+	struct position position;   
+	const char *name;           /* Id as given in the input, or name_buf */
+	char name_buf[12];          /* Name of a generated vehicle, a letter and an int */
+	struct list_elem elem;      /* In active_vehicles, or free slots */
+
 	char state;                 
 	char start;                 
 	char dest;                  
-	
 	char type;                  
-	char arrival;               
-	char golden_time;           
-	
-	struct position position;   
-	struct lock **map_locks;    
 };
 
+/* Vehicles that have arrived and not been counted out yet, in
+   arrival order. Changes only in the step barrier action, or before
+   the first step. */
+extern struct list active_vehicles;
+
 /* Function declarations */
 void vehicle_loop(void *vi);
-void parse_vehicles(struct vehicle_info *vehicle_info, char *input);
-void init_on_mainthread(int thread_cnt);
-
-/* External path data */
-extern const struct position vehicle_path[4][4][12];
+void init_on_mainthread(void);
+void start_vehicles(void);
+void wait_for_vehicles_finished(void);
+bool vehicles_finished(void);
+void release_vehicles(void);
+int vehicle_slack(const struct vehicle_info *vi);
+bool is_same_driver(const struct vehicle_info *a, const struct vehicle_info *b);
 
 #endif /* __PROJECTS_PROJECT2_VEHICLE_H__ */
\ No newline at end of file
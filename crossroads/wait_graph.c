@@ -0,0 +1,146 @@
+#include "projects/crossroads/wait_graph.h"
+#include "projects/crossroads/crossroads.h"
+#include "projects/crossroads/occupancy.h"
+#include "projects/crossroads/priority_sync.h"
+#include "projects/crossroads/stats.h"
+#include "projects/crossroads/trace.h"
+#include "threads/thread.h"
+#include "threads/interrupt.h"
+
+enum wait_verdict {
+    WAIT_KEEP,          /* The chain can still clear this step */
+    WAIT_STUCK,         /* The chain ends in a parked vehicle */
+    WAIT_CYCLE          /* Circular wait, and the caller is the victim */
+};
+
+/* Longest chain followed, one waiter per cell at most */
+#define WAIT_CHAIN_MAX (MAP_MAX_SIZE * MAP_MAX_SIZE)
+
+static bool has_parked(const struct vehicle_info* vi)
+{
+    return vi->parked_step == crossroads_step;
+}
+
+/* True if A should give way to B in a circular wait: lower priority,
+   then more slack, then the later vehicle */
+static bool yields_to(struct vehicle_info* a, struct vehicle_info* b)
+{
+    int pa = get_vehicle_priority(a);
+    int pb = get_vehicle_priority(b);
+
+    if (pa != pb) {
+        return pa < pb;
+    }
+    if (vehicle_slack(a) != vehicle_slack(b)) {
+        return vehicle_slack(a) > vehicle_slack(b);
+    }
+    return a->id > b->id;
+}
+
+/* The vehicle that the worker driving VI is waiting with, NULL if
+   that worker is not inside acquire_cell_waiting() */
+static struct vehicle_info* driver_waiter(const struct vehicle_info* vi)
+{
+    struct list_elem* e;
+
+    for (e = list_begin(&active_vehicles); e != list_end(&active_vehicles);
+        e = list_next(e)) {
+        struct vehicle_info* other = list_entry(e, struct vehicle_info, elem);
+
+        if (other != vi && is_same_driver(other, vi) && other->waiting_for.row != -1) {
+            return other;
+        }
+    }
+    return NULL;
+}
+
+static bool on_chain(struct vehicle_info** chain, int cnt, const struct vehicle_info* vi)
+{
+    for (int i = 0; i < cnt; i++) {
+        if (chain[i] == vi) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Follows the wait-for edges from the holder of POS, which VI wants.
+   A holder that has not moved yet in worker mode acts only once its
+   worker does, so the chain goes on from the vehicle that worker is
+   waiting with. Every waiter in a cycle finds the same victim, so
+   exactly one of them backs off. Runs with interrupts off so that the
+   chain does not change underneath. */
+static enum wait_verdict check_wait_chain(struct vehicle_info* vi, struct position pos)
+{
+    struct vehicle_info* waiters[WAIT_CHAIN_MAX];
+    struct vehicle_info* holder = cell_owner_at(pos);
+    int cnt = 0;
+
+    waiters[cnt++] = vi;
+    while (holder != NULL) {
+        struct vehicle_info* waiter;
+
+        if (holder == vi) {
+            /* Circular wait: pick the member that gives way */
+            struct vehicle_info* victim = vi;
+
+            for (int i = 1; i < cnt; i++) {
+                if (yields_to(waiters[i], victim)) {
+                    victim = waiters[i];
+                }
+            }
+            return victim == vi ? WAIT_CYCLE : WAIT_KEEP;
+        }
+        if (has_parked(holder)) {
+            return WAIT_STUCK;
+        }
+        if (is_same_driver(holder, vi)) {
+            return WAIT_STUCK;  /* Driven by this worker, cannot act while it waits */
+        }
+        if (holder->waiting_for.row != -1) {
+            waiter = holder;
+        }
+        else if (crossroads_options.workers > 0 && (waiter = driver_waiter(holder)) != NULL) {
+            /* Its worker is stuck waiting with another vehicle */
+        }
+        else {
+            return WAIT_KEEP;   /* Still to act this step */
+        }
+        if (cnt == WAIT_CHAIN_MAX || on_chain(waiters, cnt, waiter)) {
+            return WAIT_STUCK;  /* Loops without VI, VI cannot break it */
+        }
+        waiters[cnt++] = waiter;
+        holder = cell_owner_at(waiter->waiting_for);
+    }
+    return WAIT_KEEP;           /* Free cell at the end, retry */
+}
+
+/* Takes POS for VI, waiting for it within the current
+   step as long as the wait-for chain can still clear. Returns false
+   if VI has to give up for this step instead. */
+bool acquire_cell_waiting(struct vehicle_info* vi, struct position pos)
+{
+    bool acquired;
+
+    vi->waiting_for = pos;
+    while (!(acquired = claim_cell(vi, pos))) {
+        enum intr_level old_level = intr_disable();
+        enum wait_verdict verdict = check_wait_chain(vi, pos);
+        intr_set_level(old_level);
+
+        if (verdict == WAIT_STUCK) {
+            record_near_deadlock();
+            TRACE(TRACE_MOVES, TRACE_NEAR_DEADLOCK, vi, pos.row, pos.col);
+            break;
+        }
+        if (verdict == WAIT_CYCLE) {
+            record_deadlock();
+            TRACE(TRACE_EVENTS, TRACE_DEADLOCK, vi, pos.row, pos.col);
+            break;
+        }
+        thread_yield();
+    }
+    vi->waiting_for.row = vi->waiting_for.col = -1;
+
+    return acquired;
+}
@@ -0,0 +1,28 @@
+#ifndef __PROJECTS_CROSSROADS_WAIT_GRAPH_H__
+#define __PROJECTS_CROSSROADS_WAIT_GRAPH_H__
+
+#include <stdbool.h>
+#include "projects/crossroads/position.h"
+#include "projects/crossroads/vehicle.h"
+
+/* Wait-for graph over the map cells.
+
+   Every vehicle but an emergency ambulance takes cells with
+   claim_cell() and retries on the next step, so no thread ever
+   waits on another. An emergency ambulance waits for its next cell
+   instead, within the step. Its wait is an edge to the vehicle on
+   that cell, and from there to whatever that vehicle waits for in
+   turn. The wait is only safe while the chain ends in a vehicle that
+   still has to act this step. A chain that ends in a vehicle already
+   parked at the step barrier can never clear: with a blocking
+   lock_acquire() that was a hang. A chain that comes back to the
+   waiter is a circular wait. In worker mode, a chain that reaches a
+   vehicle driven by the waiting worker cannot clear either, and a
+   vehicle that has not moved yet waits on whatever its worker is
+   waiting for.
+
+   Cell owners come from the occupancy map, see occupancy.h. */
+
+bool acquire_cell_waiting(struct vehicle_info *vi, struct position pos);
+
+#endif /* __PROJECTS_CROSSROADS_WAIT_GRAPH_H__ */
@@ -0,0 +1,129 @@
+#include <stdio.h>
+
+#include "projects/crossroads/watchdog.h"
+#include "projects/crossroads/crossroads.h"
+#include "projects/crossroads/deadlock_prevention.h"
+#include "projects/crossroads/occupancy.h"
+#include "threads/interrupt.h"
+
+static struct list* watched_vehicles;
+
+static int moves;               /* Moves made in the current step */
+static int stalled_steps;       /* Steps in a row nothing moved */
+static bool released;           /* Released once since the last move */
+static bool aborted;
+
+void init_watchdog(struct list* vehicles)
+{
+    watched_vehicles = vehicles;
+    moves = 0;
+    stalled_steps = 0;
+    released = false;
+    aborted = false;
+}
+
+/* Called by a vehicle that moved or left the map. A lost increment
+   could make a step with moves look stalled, so interrupts are off
+   for it. */
+void watchdog_note_move(void)
+{
+    enum intr_level old_level = intr_disable();
+
+    moves++;
+    intr_set_level(old_level);
+}
+
+/* True if some vehicle is on the road and expected to move. Ambulances
+   waiting for their dispatch step do not count. */
+static bool has_active_vehicle(void)
+{
+    struct list_elem* e;
+
+    for (e = list_begin(watched_vehicles); e != list_end(watched_vehicles); e = list_next(e)) {
+        struct vehicle_info* vi = list_entry(e, struct vehicle_info, elem);
+
+        if (vi->state != VEHICLE_STATUS_FINISHED && crossroads_step >= vi->arrival) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Prints who holds which cell and what every vehicle on the road is
+   waiting for */
+void dump_crossroads_state(void)
+{
+    struct list_elem* e;
+
+    printf("---- crossroads state at step %d ----\n", crossroads_step);
+    for (int row = 0; row < map_layout->size; row++) {
+        for (int col = 0; col < map_layout->size; col++) {
+            struct position pos = { row, col };
+            struct vehicle_info* owner = cell_owner_at(pos);
+
+            printf("%c ", owner != NULL ? owner->name[0] : '.');
+        }
+        printf("\n");
+    }
+
+    for (e = list_begin(watched_vehicles); e != list_end(watched_vehicles); e = list_next(e)) {
+        struct vehicle_info* vi = list_entry(e, struct vehicle_info, elem);
+        struct position next;
+
+        if (vi->state != VEHICLE_STATUS_RUNNING) {
+            continue;
+        }
+        next = vehicle_path[vi->start - 'A'][vi->dest - 'A'][vi->path_step];
+        printf("%-6s at (%d,%d) next (%d,%d) blocked %d steps",
+            vi->name, vi->position.row, vi->position.col, next.row, next.col,
+            vi->blocked_steps);
+        if (vi->type == VEHICL_TYPE_AMBULANCE) {
+            printf(", slack %d", vehicle_slack(vi));
+        }
+        printf("\n");
+    }
+    dump_admission_state();
+    printf("-------------------------------------\n");
+}
+
+/* Runs in the step barrier action, with every vehicle parked. Once
+   nothing has moved for crossroads_options.watchdog steps the state
+   is dumped and the policy applied. Release clears admissions that
+   have not turned into moves yet, and gives the run another period;
+   if that does not help either, the run is aborted. Abort makes every
+   vehicle leave the map at its next turn and ends the input, so
+   run_crossroads() returns and reports instead of spinning forever. */
+void watchdog_step(void)
+{
+    if (moves > 0 || !has_active_vehicle()) {
+        moves = 0;
+        stalled_steps = 0;
+        released = false;
+        return;
+    }
+
+    stalled_steps++;
+    if (aborted || crossroads_options.watchdog == 0 ||
+        stalled_steps < crossroads_options.watchdog) {
+        return;
+    }
+
+    printf("WATCHDOG: no vehicle has moved for %d steps\n", stalled_steps);
+    dump_crossroads_state();
+
+    if (crossroads_options.watchdog_policy == WATCHDOG_RELEASE && !released) {
+        printf("WATCHDOG: releasing pending center admissions\n");
+        reset_admission(watched_vehicles);
+        released = true;
+        stalled_steps = 0;
+    }
+    else {
+        printf("WATCHDOG: aborting the run\n");
+        aborted = true;
+    }
+}
+
+bool watchdog_aborted(void)
+{
+    return aborted;
+}
@@ -0,0 +1,17 @@
+#ifndef __PROJECTS_CROSSROADS_WATCHDOG_H__
+#define __PROJECTS_CROSSROADS_WATCHDOG_H__
+
+#include <stdbool.h>
+#include "projects/crossroads/vehicle.h"
+
+/* What the watchdog does when nothing has moved for too long */
+#define WATCHDOG_RELEASE 0  /* Drop pending admissions, fail if that does not help */
+#define WATCHDOG_FAIL    1  /* Abort the run */
+
+void init_watchdog(struct list *vehicles);
+void watchdog_note_move(void);
+void watchdog_step(void);
+bool watchdog_aborted(void);
+void dump_crossroads_state(void);
+
+#endif /* __PROJECTS_CROSSROADS_WATCHDOG_H__ */